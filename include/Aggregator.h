@@ -5,11 +5,23 @@
 #include <vector>
 #include <string>
 #include <map>
-// #include <mutex>
+#include <mutex>
+#include <deque>
 #include <condition_variable>
 #include <thread>
 #include <grpcpp/grpcpp.h>
 #include "aggregator.grpc.pb.h"  // Generated from proto
+#include "order_book.h"
+#include "book_signals.h"
+#include "cross_detector.h"
+#include "handler_memory.h"
+#include "book_snapshot.h"
+#include "tick_store.h"
+#include "book_history.h"
+#include "depth_index.h"
+#include "runtime_config.h"
+#include "relay_client.h"
+#include "spsc_ring.h"
 
 struct market_event {
     std::string exchange;
@@ -26,38 +38,267 @@ public:
 
     void start(const std::string& config_file_path);
 
-    // 被 connector 调用，异步 post 到 strand 处理
-    void on_book_updated(market_connector* connector);
+    // start() 之后有效，main 用它决定 io 线程绑核 / 忙轮询
+    const runtime_config& runtime() const { return runtime_; }
+
+    // 被 connector 在自己的 strand 上调用：changes 是该交易所本条消息的档位变化，top 是处理后它的最优价，
+    // rx_ns 是这条消息的内核接收时间（0 = 没有）
+    // 变化拷进该交易所的 SPSC 环，strand 上成批取出；changes 返回后即可复用
+    void on_book_updated(market_connector* connector, const std::vector<level_change>& changes, top_of_book top,
+                         int64_t rx_ns);
+
+    // 被 connector 在自己的 strand 上调用：成交不经过合并簿，直接写进成交环并唤醒推送线程
+    void on_trades(const std::vector<trade_print>& trades);
+
+    // 合并发布统计：coalesced = updates - versions
+    struct coalesce_stats {
+        uint64_t updates = 0;      // 应用到合并簿的消息数
+        uint64_t versions = 0;     // 发布的版本数
+        uint64_t coalesced = 0;    // 被并入同一版本、没有单独发布的消息数
+        uint64_t max_burst = 0;    // 单个版本合并的最多消息数
+    };
+    coalesce_stats coalescing() const;
 
 private:
+    friend struct test_access;   // src/tests.cpp
+
     void on_market_event(const market_event& evt);
 
     void start_grpc_server();
+    void pin_publisher_thread();
 
     // gRPC 服务实现
     grpc::Status SubscribeBook(grpc::ServerContext* context,
                                const aggregator::SubscribeRequest* request,
                                grpc::ServerWriter<aggregator::BookUpdate>* writer) override;
+
+    grpc::Status SubscribeSignals(grpc::ServerContext* context,
+                                  const aggregator::SubscribeRequest* request,
+                                  grpc::ServerWriter<aggregator::Signals>* writer) override;
+
+    grpc::Status SubscribeBBO(grpc::ServerContext* context,
+                              const aggregator::SubscribeRequest* request,
+                              grpc::ServerWriter<aggregator::BBO>* writer) override;
+
+    grpc::Status SubscribeCrosses(grpc::ServerContext* context,
+                                  const aggregator::SubscribeRequest* request,
+                                  grpc::ServerWriter<aggregator::CrossEvent>* writer) override;
+
+    grpc::Status SubscribeTrades(grpc::ServerContext* context,
+                                 const aggregator::SubscribeRequest* request,
+                                 grpc::ServerWriter<aggregator::TradeBatch>* writer) override;
+
+    // 从内存历史重建某一时刻的合并簿；未开启 "history" 或时刻早于保留窗口时返回错误
+    grpc::Status GetBookAt(grpc::ServerContext* context,
+                           const aggregator::BookAtRequest* request,
+                           aggregator::BookUpdate* response) override;
+
+    // 前缀和索引上的累计深度查询：到某价位的累计量 / 累计数量或金额达到阈值的价位，一次请求多项
+    grpc::Status QueryDepth(grpc::ServerContext* context,
+                            const aggregator::DepthQuery* request,
+                            aggregator::DepthResult* response) override;
+
+    grpc::Status GetStats(grpc::ServerContext* context,
+                          const aggregator::StatsRequest* request,
+                          aggregator::Stats* response) override;
+
+    // 各连接器的计数在它自己的 strand 上读、合并簿的在 strand_ 上读，热路径上不加锁；
+    // 某个 strand 1 秒内没响应时跳过那一部分
+    void collect_stats(aggregator::Stats& out);
+    // runtime.stats_interval_ms > 0 时在独立线程里周期打印
+    void run_stats_dump();
+
+    // 订阅者统计：每条记录只由对应的推送线程写
+    struct subscriber_entry {
+        uint64_t id = 0;
+        std::string rpc;
+        std::string peer;
+        int64_t connected_ms = 0;
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> skipped{0};
+        std::atomic<int64_t> last_lag_us{0};
+        std::atomic<int64_t> max_lag_us{0};
+    };
+    std::shared_ptr<subscriber_entry> add_subscriber(const char* rpc, grpc::ServerContext* context);
+    void remove_subscriber(const std::shared_ptr<subscriber_entry>& sub);
     
-    // 在 strand 上执行的更新逻辑
-    void update_consolidated_book(market_connector* connector);
+    // BBO 快速路径：由各交易所最优价直接求合并最优价（O(交易所数)），变化时立即推送，不等合并簿发布版本
+    void update_bbo(std::size_t venue, const top_of_book& top);
+
+    // 把 cross_events_ 转成 proto 放进最近事件队列并唤醒推送线程（在 strand 内调用）
+    void publish_crosses();
+
+    // 在 strand 上执行的更新逻辑：只改变化涉及的价位
+    void update_consolidated_book(std::size_t venue, const std::vector<level_change>& changes, int64_t rx_ns = 0);
+    // 改合并簿的一个档位，同步信号、历史和深度索引
+    void apply_level(std::size_t venue, const level_change& c);
+
+    // strand 上把某交易所环里的消息按顺序全部应用
+    void drain_handoff(std::size_t venue);
+
+    // 一批更新应用完后发布一个版本：版本号、历史存储、信号（在 strand 内调用）
+    void publish_version();
+
+    // relay 模式：启动时从上游第一份簿确定交易所列表，之后由 relay 线程送来上游的簿和成交
+    void start_relay(relay_config cfg);
+    void on_relay_book(aggregator::BookUpdate& update);        // relay 线程：只保留最新一份，排一次 strand
+    void apply_relay_book(const aggregator::BookUpdate& update);  // strand：与合并簿做差，按交易所走正常更新路径
+    void on_relay_trades(const aggregator::TradeBatch& batch);  // relay 线程
+    top_of_book venue_top(std::size_t venue) const;
+
+    // 热启动：启动时载入上次的快照，交易所各自的第一条实时数据到来前标记为 stale
+    void restore_snapshot();
+    void drop_stale_venue(std::size_t venue);
+    bool any_venue_stale() const;
+    void schedule_snapshot();
+    void write_snapshot();
+    void run_snapshot_writer();
 
-    // 构建 proto 消息（在 strand 内调用）
-    aggregator::BookUpdate build_book_update();
+    // 信号有变化时拷贝给推送线程并唤醒（在 strand 内调用）
+    void publish_signals(uint64_t version);
+
+    // 构建 proto 消息（在 strand 内调用）；with_venues 时每档附带各交易所分量
+    aggregator::BookUpdate build_book_update(bool with_venues);
+    // 把 bids / asks 的前 depth 档写进 update（BookUpdate 和 GetBookAt 共用）
+    void add_book_levels(aggregator::BookUpdate& update, const consolidated_bid_book& bids,
+                         const consolidated_ask_book& asks, bool with_venues, int depth) const;
     
     boost::asio::io_context& ioc_;
     boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    std::shared_ptr<handler_memory> handler_mem_ = std::make_shared<handler_memory>();  // strand_ 上自己 post 的回调
     
     std::vector<std::shared_ptr<market_connector>> connectors_;
+    std::vector<std::string> venue_names_;  // 下标 = venue id
+    std::vector<std::shared_ptr<market_connector>> backup_lines_;  // A/B 备线，不单独占 venue id
+
+    // connector -> strand 的交接：每个交易所一对预分配的 SPSC 环（档位变化 + 消息头），
+    // 生产者是该交易所主线路的 strand（备线也经它交付），消费者是 strand_
+    // 环里有数据时只 post 一次 drain，一次取完；环满时这条消息退回按值 post，
+    // 退回的消息还没应用前后续消息也走退回路径，保证同一交易所的顺序
+    static constexpr std::size_t HANDOFF_CHANGES = 32768;
+    static constexpr std::size_t HANDOFF_MESSAGES = 4096;
+    struct handoff_message {
+        top_of_book top;
+        int64_t rx_ns = 0;
+        std::size_t changes = 0;
+    };
+    struct venue_handoff {
+        spsc_ring<level_change> changes{HANDOFF_CHANGES};
+        spsc_ring<handoff_message> messages{HANDOFF_MESSAGES};
+        std::atomic<bool> drain_scheduled{false};
+        std::atomic<uint32_t> fallback_inflight{0};   // 已按值 post、strand 还没执行的消息数
+    };
+    std::array<std::unique_ptr<venue_handoff>, MAX_VENUES> handoff_;
+    std::vector<level_change> handoff_scratch_;     // strand 上复用，容量 HANDOFF_CHANGES
+    std::atomic<uint64_t> handoff_overflows_{0};
+
+    // relay 模式（"relay": {"upstream": ...}）：不连交易所，venue_names_ 在 start() 里确定后不再改
+    std::unique_ptr<relay_client> relay_;
+    std::mutex relay_mutex_;
+    aggregator::BookUpdate relay_book_;    // 受 relay_mutex_ 保护：还没应用的最新上游簿
+    bool relay_book_pending_ = false;      // 受 relay_mutex_ 保护
+    std::array<std::vector<level_change>, MAX_VENUES> relay_changes_;  // strand 上复用
+    std::vector<trade_print> relay_trades_;                           // 成交 relay 线程复用
 
     // consolidated 数据（只在 strand 线程访问）
-    std::map<double, double, std::greater<double>> consolidated_bids_;
-    std::map<double, double> consolidated_asks_;
+    // 按档位增量维护，每档带各交易所分量；节点在 book_mem_ 池内循环复用
+    book_memory book_mem_;
+    consolidated_bid_book consolidated_bids_;
+    consolidated_ask_book consolidated_asks_;
+
+    // 快照相关状态（只在 strand 线程访问）
+    snapshot_config snapshot_cfg_;
+    boost::asio::steady_timer snapshot_timer_;
+    uint64_t snapshot_version_ = 0;                       // 上次交给写线程时的 version_
+    std::array<bool, MAX_VENUES> venue_stale_{};          // 数据来自快照，尚未收到实时更新
+    std::array<int64_t, MAX_VENUES> venue_update_ms_{};   // 各交易所最后一次更新时间
+
+    // 每个合并簿版本追加到列式历史存储（只在 strand 线程访问，未配置时为空）
+    // strand 上只拷贝前 depth 档，写文件在 tick_store 自己的写线程里
+    std::unique_ptr<tick_store> tick_store_;
+
+    // 最近几分钟的版本（变化 + 检查点），供 GetBookAt 查询；strand 上写，gRPC 线程加锁读（未配置时为空）
+    std::unique_ptr<book_history> history_;
+
+    // 合并簿两侧的累计数量 / 金额前缀和（只在 strand 线程访问，未配置时为空）
+    std::unique_ptr<depth_index> depth_index_;
+
+    // 信号在 strand 上随档位变化维护，变化后拷贝到 latest_signals_ 供推送线程读取
+    book_signals signals_;
+    std::mutex signals_mutex_;
+    std::condition_variable signals_cv_;
+    aggregator::Signals latest_signals_;  // 受 signals_mutex_ 保护
+
+    // 各交易所最优价与合并 BBO（只在 strand 线程访问），变化后拷贝到 latest_bbo_ 供推送线程读取
+    std::array<top_of_book, MAX_VENUES> venue_bbo_{};
+    top_of_book bbo_;
+    std::mutex bbo_mutex_;
+    std::condition_variable bbo_cv_;
+    aggregator::BBO latest_bbo_;  // 受 bbo_mutex_ 保护
+
+    // 跨交易所 crossed / locked 检测（strand 上），事件放进最近事件队列供推送线程按 seq 读取
+    static constexpr std::size_t MAX_RECENT_CROSSES = 1024;
+    cross_detector crosses_;
+    std::vector<cross_event> cross_events_;           // strand 上复用的临时缓冲
+    std::mutex crosses_mutex_;
+    std::condition_variable crosses_cv_;
+    std::deque<aggregator::CrossEvent> recent_crosses_;  // 受 crosses_mutex_ 保护
+    uint64_t cross_seq_ = 0;                             // 受 crosses_mutex_ 保护
+
+    // 合并逐笔成交：各 connector 按到达顺序写进固定大小的环，推送线程按 seq 成批读取
+    static constexpr std::size_t MAX_RECENT_TRADES = 8192;
+    std::mutex trades_mutex_;
+    std::condition_variable trades_cv_;
+    std::vector<trade_print> trade_ring_ = std::vector<trade_print>(MAX_RECENT_TRADES);  // 受 trades_mutex_ 保护，seq s 在 s % MAX_RECENT_TRADES
+    uint64_t trade_seq_ = 0;                                                             // 受 trades_mutex_ 保护
 
     // 最新 proto 消息（只在 strand 线程写入，其他线程只读快照）
     // aggregator::BookUpdate latest_book_update_;
     std::atomic<uint64_t> version_{0};  // 用于客户端判断是否有新数据
 
+    // 突发时多条更新合并成一个版本（标志只在 strand 线程访问，计数供其他线程读取）
+    bool publish_pending_ = false;
+    uint64_t pending_updates_ = 0;
+    std::atomic<uint64_t> book_updates_{0};
+    std::atomic<uint64_t> versions_published_{0};
+    std::atomic<uint64_t> max_burst_{0};
+
+    // strand 排队深度（connector 线程 +1，strand 上 -1）与合并耗时（只在 strand 线程访问）
+    std::atomic<int64_t> strand_queue_{0};
+    std::atomic<int64_t> max_strand_queue_{0};
+    uint64_t apply_ns_ = 0;
+    uint64_t max_apply_ns_ = 0;
+    uint64_t publish_ns_ = 0;
+    uint64_t max_publish_ns_ = 0;
+    int64_t version_published_ns_ = 0;   // 最近一个版本发布时的 steady_clock，算订阅者延迟
+    int64_t version_wall_ns_ = 0;        // 同一时刻的 system_clock，写进 BookUpdate.timestamp_ns
+
+    // 内核接收时间戳（system_clock ns，只在 strand 线程访问）
+    int64_t book_rx_ns_ = 0;             // 已应用到合并簿的最新一条消息，随 BookUpdate 发出
+    int64_t pending_rx_ns_ = 0;          // 当前这批更新里最早的一条，发布时算接收到发布的延迟
+    uint64_t rx_to_publish_ns_ = 0;
+    uint64_t max_rx_to_publish_ns_ = 0;
+
+    std::mutex subscribers_mutex_;
+    std::vector<std::shared_ptr<subscriber_entry>> subscribers_;  // 受 subscribers_mutex_ 保护
+    uint64_t next_subscriber_id_ = 0;                             // 受 subscribers_mutex_ 保护
+
+    std::thread stats_thread_;
+    std::mutex stats_stop_mutex_;
+    std::condition_variable stats_stop_cv_;
+    bool stats_stop_ = false;   // 受 stats_stop_mutex_ 保护
+
+    // 快照落盘线程：strand 上只拷贝合并簿，文件 I/O 在这里做；第一次写快照时启动
+    std::thread snapshot_thread_;
+    std::mutex snapshot_mutex_;
+    std::condition_variable snapshot_cv_;
+    std::unique_ptr<book_snapshot> snapshot_queued_;   // 受 snapshot_mutex_ 保护；只留最新一份
+    bool snapshot_stop_ = false;                       // 受 snapshot_mutex_ 保护
+    std::atomic<bool> snapshot_failed_{false};         // 上次落盘失败，下一轮即使没有新版本也重写
+
+    runtime_config runtime_;
+    std::atomic<unsigned> next_publisher_core_{0};  // publisher_cores 轮询下标
+
     std::thread grpc_thread_;
     std::unique_ptr<grpc::Server> grpc_server_;
 };
@@ -0,0 +1,59 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// 按流水线阶段统计堆分配：cmake -DAGGREGATOR_ALLOC_PROFILE=ON 时替换全局 operator new（src/alloc_hooks.cpp），
+// 每次分配记到当前线程正处在的阶段；关闭时 alloc_scope 是空操作，热路径上没有任何开销
+// 只统计 operator new，C 库（gRPC core、OpenSSL、zlib）直接 malloc 的内存不在内
+enum class alloc_stage : uint8_t {
+    other,          // 不在任何阶段里（启动、gRPC 内部线程等）
+    read,           // websocket 读：TLS 解密、读帧 / inflate、拷贝帧、投递备线
+    parse,          // 解析 JSON、改本地簿、交给合并簿
+    consolidate,    // strand 上应用档位变化、发布版本
+    build,          // 构建 proto 消息
+    write,          // gRPC 写（含序列化）
+    count
+};
+
+const char* alloc_stage_name(alloc_stage stage);
+
+struct alloc_stage_stats {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+using alloc_profile = std::array<alloc_stage_stats, static_cast<std::size_t>(alloc_stage::count)>;
+
+#ifdef AGGREGATOR_ALLOC_PROFILE
+inline constexpr bool alloc_profile_enabled = true;
+
+extern thread_local alloc_stage g_alloc_stage;
+
+// 作用域内的分配记到 stage，退出时恢复外层阶段（可以嵌套）
+class alloc_scope {
+public:
+    explicit alloc_scope(alloc_stage stage) : prev_(g_alloc_stage) { g_alloc_stage = stage; }
+    ~alloc_scope() { g_alloc_stage = prev_; }
+
+    alloc_scope(const alloc_scope&) = delete;
+    alloc_scope& operator=(const alloc_scope&) = delete;
+
+private:
+    alloc_stage prev_;
+};
+
+// 由替换后的 operator new 调用
+void alloc_profile_record(std::size_t bytes);
+#else
+inline constexpr bool alloc_profile_enabled = false;
+
+class alloc_scope {
+public:
+    explicit alloc_scope(alloc_stage) {}
+};
+#endif
+
+// 进程启动（或上次 reset）以来各阶段的累计；未开启时全为 0
+alloc_profile alloc_profile_snapshot();
+void alloc_profile_reset();
@@ -1,23 +1,23 @@
 #pragma once
-#include "market_connector.h"
+#include "venue_connector.h"
 
-class Aggregator;  // 前向声明
+// Binance 现货 depth20@100ms：URL 即订阅，每条都是前 20 档全量快照
+// 连上后在同一条连接上再订阅 @trade 逐笔成交
+struct binance_venue {
+    static constexpr const char* name = "Binance";
+    static constexpr ping_kind ping = ping_kind::ws_ping;
 
-class binance_connector : public market_connector {
-public:
-    // binance_connector(net::io_context& ioc, event_callback cb);
-    // 与基类签名一致 + Aggregator*
-    binance_connector(net::io_context& ioc,
-                      Aggregator* aggregator,
-                      std::string name,
-                      std::string host,
-                      std::string port,
-                      std::string path,
-                      event_callback cb);
-
-protected:
-    std::string subscription_message() const override;
-    void handle_message(const std::string& msg) override;
-    // 必须声明 override（基类有纯虚函数）
-    void parse_message(const std::string& msg) override;
+    static std::string subscription_message() {
+        return R"({"method":"SUBSCRIBE","params":["btcusdt@trade"],"id":1})";
+    }
+    // 多线路去重用：depth 推送的 lastUpdateId（成交没有，add_trade 按成交号去重）
+    static uint64_t sequence_id(const std::string& msg) {
+        return market_connector::find_uint_field(msg, "lastUpdateId");
+    }
+    static bool sequence_reset(const std::string&) { return false; }
+    static void parse(venue_connector<binance_venue>& c, const std::string& msg);
 };
+
+// 解析函数与 deliver() 在 binance_connector.cpp 里一起实例化，保证能内联
+extern template class venue_connector<binance_venue>;
+using binance_connector = venue_connector<binance_venue>;
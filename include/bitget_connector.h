@@ -1,21 +1,24 @@
 #pragma once
-#include "market_connector.h"
+#include "venue_connector.h"
 
-class Aggregator;
+// Bitget 现货 books50
+struct bitget_venue {
+    static constexpr const char* name = "Bitget";
+    static constexpr ping_kind ping = ping_kind::json_op_ts;
 
-class bitget_connector : public market_connector {
-public:
-    // bitget_connector(net::io_context& ioc, event_callback cb);
-    bitget_connector(net::io_context& ioc,
-                     Aggregator* aggregator,
-                     std::string name,
-                     std::string host,
-                     std::string port,
-                     std::string path,
-                     event_callback cb);
-
-protected:
-    std::string subscription_message() const override;
-    void handle_message(const std::string& msg) override;
-    void parse_message(const std::string& msg) override;
+    static std::string subscription_message() {
+        return R"({
+        "op":"subscribe",
+        "args":[{"instType":"SPOT","channel":"books50","instId":"BTCUSDT"}]
+    })";
+    }
+    // 多线路去重用：books 频道的 seq
+    static uint64_t sequence_id(const std::string& msg) {
+        return market_connector::find_uint_field(msg, "seq");
+    }
+    static bool sequence_reset(const std::string&) { return false; }
+    static void parse(venue_connector<bitget_venue>& c, const std::string& msg);
 };
+
+extern template class venue_connector<bitget_venue>;
+using bitget_connector = venue_connector<bitget_venue>;
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "order_book.h"
+
+// exchanges.json 里 "history" 段；seconds 为 0 表示不保留历史
+struct history_config {
+    int seconds = 0;                        // 至少能回看多久
+    std::size_t checkpoint_deltas = 65536;  // 累计这么多档位变化做一次全簿检查点
+    int checkpoint_interval_ms = 10000;     // 变化很少时也至少这么久做一次
+    std::size_t max_deltas = 8'000'000;     // 档位变化总数上限（约 24 字节一条），超过时提前淘汰
+};
+
+history_config parse_history_config(const nlohmann::json& j);
+
+// 最近一段时间的合并簿版本：每个版本只记它的档位变化，隔一段做一次全簿检查点
+// 查询某时刻 = 之前最近的检查点 + 重放到该时刻的变化；淘汰按检查点整段丢弃
+// add / commit 只在 strand 上调用；book_at 可以在任意线程调用，锁内只拷贝检查点指针和变化
+class book_history {
+public:
+    explicit book_history(history_config cfg);
+
+    // 记一条档位变化（某交易所在此价位的新数量），属于下一个 commit 的版本
+    void add(std::size_t venue, const level_change& change);
+    // 发布一个版本；需要时拷贝 bids / asks 作为检查点，并淘汰过期的段
+    void commit(int64_t ts_ns, uint64_t version, const consolidated_bid_book& bids, const consolidated_ask_book& asks);
+
+    // 重建 ts_ns 时刻（含）的合并簿：写进 bids / asks（先清空），返回该版本的号和发布时间
+    // ts_ns 早于保留的最早检查点或还没有任何版本时返回 false
+    bool book_at(int64_t ts_ns, consolidated_bid_book& bids, consolidated_ask_book& asks,
+                 uint64_t& version, int64_t& version_ts_ns) const;
+
+    struct usage {
+        uint64_t versions = 0;
+        uint64_t deltas = 0;
+        uint64_t checkpoints = 0;
+        uint64_t bytes = 0;         // 变化 + 版本索引 + 检查点档位的估算
+        int64_t from_ns = 0;        // 可查询的最早时刻
+    };
+    usage stats() const;
+
+    const history_config& config() const { return cfg_; }
+
+private:
+    struct delta {
+        double price;
+        double qty;
+        uint8_t venue;
+        book_side side;
+    };
+    struct version_entry {
+        int64_t ts_ns;
+        uint64_t version;
+        uint64_t delta_end;     // 该版本最后一条变化之后的绝对下标
+    };
+    struct checkpoint {
+        int64_t ts_ns;
+        uint64_t version_pos;   // 对应 versions_ 里的绝对下标
+        uint64_t delta_pos;     // 检查点之后第一条变化的绝对下标
+        std::vector<std::pair<double, venue_level>> bids;
+        std::vector<std::pair<double, venue_level>> asks;
+    };
+
+    void evict(int64_t now_ns);
+
+    history_config cfg_;
+    std::vector<delta> pending_;            // strand 上攒的本版本变化
+    int64_t last_ts_ns_ = 0;                // 以下只在 strand 上访问
+    int64_t last_checkpoint_ns_ = 0;
+    uint64_t since_checkpoint_ = 0;         // 上个检查点之后的变化数
+    bool has_checkpoint_ = false;
+
+    mutable std::mutex mutex_;
+    std::deque<delta> deltas_;              // 以下受 mutex_ 保护
+    std::deque<version_entry> versions_;
+    std::deque<std::shared_ptr<const checkpoint>> checkpoints_;
+    uint64_t first_delta_ = 0;              // deltas_.front() 的绝对下标
+    uint64_t first_version_ = 0;            // versions_.front() 的绝对下标
+    uint64_t checkpoint_levels_ = 0;
+};
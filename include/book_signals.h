@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "order_book.h"
+
+// exchanges.json 里 "signals" 段
+struct signal_config {
+    std::size_t imbalance_levels = 5;   // 前 N 档买卖量失衡
+    double vwap_depth = 1.0;            // 吃掉这么多数量的成交均价（基础币数量）
+};
+
+signal_config parse_signal_config(const nlohmann::json& j);
+
+struct signal_values {
+    double best_bid = 0.0;
+    double best_ask = 0.0;
+    double microprice = 0.0;    // 按对手方数量加权的中间价
+    double imbalance = 0.0;     // (bid_qty - ask_qty) / (bid_qty + ask_qty)，前 N 档
+    double bid_vwap = 0.0;      // 卖出 vwap_depth 数量的均价
+    double ask_vwap = 0.0;      // 买入 vwap_depth 数量的均价
+};
+
+// 在合并簿上维护 microprice / 前 N 档失衡 / 深度 VWAP
+// 每侧记住上次计算用到的最深价位，变化落在它之外时直接忽略，
+// 只有影响前 N 档或 VWAP 深度的变化才在 refresh() 时重算那一侧（只走覆盖区域）
+class book_signals {
+public:
+    explicit book_signals(signal_config cfg = {});
+
+    // 每个档位变化调用一次（strand 上）
+    void on_level_changed(book_side side, double price);
+
+    // 批次结束后调用，有数值变化时返回 true
+    bool refresh(const consolidated_bid_book& bids, const consolidated_ask_book& asks);
+
+    const signal_values& values() const { return values_; }
+    const signal_config& config() const { return cfg_; }
+
+private:
+    struct side_state {
+        bool dirty = true;
+        bool covers_all = true;     // 簿太薄，任何价位的变化都可能影响结果
+        double boundary = 0.0;      // 上次计算走到的最深价位
+        double best_price = 0.0;
+        double best_qty = 0.0;
+        double top_qty = 0.0;       // 前 N 档数量和
+        double vwap = 0.0;
+    };
+
+    template <class Book>
+    void recompute(side_state& st, const Book& book);
+
+    signal_config cfg_;
+    side_state bid_;
+    side_state ask_;
+    signal_values values_;
+};
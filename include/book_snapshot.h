@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "order_book.h"
+
+// exchanges.json 里 "snapshot" 段；path 为空表示不落盘
+struct snapshot_config {
+    std::string path;
+    int interval_ms = 1000;
+};
+
+snapshot_config parse_snapshot_config(const nlohmann::json& j);
+
+struct snapshot_venue {
+    std::string name;
+    int64_t last_update_ms = 0;     // 该交易所最后一次有效更新的时间
+};
+
+// 合并簿快照：每档带各交易所分量，即同时包含各交易所自己的簿
+struct book_snapshot {
+    int64_t timestamp_ms = 0;
+    std::vector<snapshot_venue> venues;  // 下标 = 写入时的 venue id
+    std::vector<std::pair<double, venue_level>> bids;
+    std::vector<std::pair<double, venue_level>> asks;
+};
+
+// mmap 写临时文件、msync + fsync 后 rename 并 fsync 目录，读者和崩溃重启都看不到写了一半的文件
+// 会阻塞在磁盘 I/O 上，不要在 strand 上调用
+bool save_book_snapshot(const std::string& path, const book_snapshot& snap);
+bool load_book_snapshot(const std::string& path, book_snapshot& out);
@@ -1,20 +1,29 @@
 #pragma once
-#include "market_connector.h"
+#include "venue_connector.h"
 
-class Aggregator;
+// Bybit 现货 orderbook.50：先 snapshot，之后 delta（qty == 0 删除）；同一连接上订阅 publicTrade 逐笔成交
+struct bybit_venue {
+    static constexpr const char* name = "Bybit";
+    static constexpr ping_kind ping = ping_kind::json_op;
 
-class bybit_connector : public market_connector {
-public:
-    bybit_connector(net::io_context& ioc,
-                    Aggregator* aggregator,
-                    std::string name,
-                    std::string host,
-                    std::string port,
-                    std::string path,
-                    event_callback cb);
-
-protected: 
-    std::string subscription_message() const override;
-    void handle_message(const std::string& msg) override;
-    void parse_message(const std::string& msg) override;
+    static std::string subscription_message() {
+        // Bybit 现货 50 档深度，100ms 推送
+        return R"({
+        "op": "subscribe",
+        "args": ["orderbook.50.BTCUSDT", "publicTrade.BTCUSDT"]
+    })";
+    }
+    // 多线路去重用：orderbook 的 update id "u"（成交没有，add_trade 按成交号去重）
+    static uint64_t sequence_id(const std::string& msg) {
+        return market_connector::find_uint_field(msg, "u");
+    }
+    // 服务重启后 Bybit 重发 snapshot，u 从 1 重新开始；不重置的话这份快照和之后的增量都会被当成旧消息丢掉
+    // 成交消息也带 "type":"snapshot"，但没有 u，不会走到这里
+    static bool sequence_reset(const std::string& msg) {
+        return msg.find(R"("type":"snapshot")") != std::string::npos;
+    }
+    static void parse(venue_connector<bybit_venue>& c, const std::string& msg);
 };
+
+extern template class venue_connector<bybit_venue>;
+using bybit_connector = venue_connector<bybit_venue>;
@@ -0,0 +1,48 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "order_book.h"
+
+enum class cross_kind : uint8_t { none, locked, crossed };
+
+// 一个交易所的买价 >= 另一个交易所的卖价：开始 / 变化（locked <-> crossed）/ 结束各产生一条事件
+struct cross_event {
+    cross_kind kind = cross_kind::none;   // none = 结束
+    std::size_t bid_venue = 0;
+    std::size_t ask_venue = 0;
+    double bid_price = 0.0;
+    double ask_price = 0.0;
+    double size = 0.0;                    // min(bid_qty, ask_qty)，结束事件为结束前最后的值
+    int64_t ts_ns = 0;
+    int64_t duration_ns = 0;              // 只在结束事件里有值：从开始到结束
+};
+
+// 在各交易所最优价上检测跨交易所的 crossed / locked，不看深度
+// 某交易所最优价变化时只检查与它有关的交易所对，O(交易所数)
+class cross_detector {
+public:
+    // tops 是所有交易所当前最优价，venue 是刚变化的那个；新事件追加到 out
+    void on_venue_top(std::size_t venue, const std::array<top_of_book, MAX_VENUES>& tops,
+                      std::size_t venue_count, int64_t now_ns, std::vector<cross_event>& out);
+
+    cross_kind state(std::size_t bid_venue, std::size_t ask_venue) const {
+        return pairs_[bid_venue][ask_venue].kind;
+    }
+
+private:
+    struct pair_state {
+        cross_kind kind = cross_kind::none;
+        int64_t since_ns = 0;
+        double bid_price = 0.0;
+        double ask_price = 0.0;
+        double size = 0.0;
+    };
+
+    void check_pair(std::size_t bid_venue, std::size_t ask_venue,
+                    const std::array<top_of_book, MAX_VENUES>& tops, int64_t now_ns,
+                    std::vector<cross_event>& out);
+
+    std::array<std::array<pair_state, MAX_VENUES>, MAX_VENUES> pairs_{};
+};
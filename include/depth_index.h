@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "order_book.h"
+
+// exchanges.json 里 "depth_index" 段；tick 为 0 表示不建索引
+struct depth_index_config {
+    double tick = 0.0;                  // 价格网格，取各交易所最小价位变动的公约数，如 BTCUSDT 0.01
+    std::size_t ticks = 1u << 20;       // 窗口宽度（格数），以中间价为中心；每格每侧 16 字节
+                                        // 重新居中要清零、重建 4 个 ticks 长的数组（缺省 4 x 8MB，毫秒级），
+                                        // 只有第一次建在 strand 上做，之后在后台线程建备用树
+};
+
+depth_index_config parse_depth_index_config(const nlohmann::json& j);
+
+// 从最优价累计到某处的深度
+struct depth_point {
+    double price = 0.0;         // to_price 时为查询价；阈值查询时为达到阈值的价位（未达到为 0）
+    double quantity = 0.0;      // 累计数量
+    double notional = 0.0;      // 累计金额 sum(price * qty)
+    bool reached = true;        // 阈值查询：窗口内的总量不够时为 false，此时给出窗口内的全部累计
+    bool past_window = false;   // 查询越过了窗口远端，窗口外的档位没有计入
+};
+
+// 合并簿两侧的前缀和索引：按价格网格（tick）把档位放进以中间价为中心的窗口，
+// 每侧两棵 Fenwick 树（数量、金额），下标从最优价一端开始，前缀和 = 从最优价累计
+// 档位变化时 O(log n) 更新，累计到价位 / 累计达到数量或金额的查询也是 O(log n)
+// 只在 strand 上使用；中间价偏出窗口中部一半时重新居中，顺便清掉浮点累积误差：
+// 第一次用 rebuild 直接建，之后用 begin_rebuild 在后台线程建到备用树，poll_rebuild 建好时换上
+class depth_index {
+public:
+    explicit depth_index(depth_index_config cfg);
+    ~depth_index();
+
+    // 合并簿某档总量变化 delta（apply_venue_level 的返回值）；窗口外的价位忽略
+    void on_level_changed(book_side side, double price, double delta);
+
+    // 最优价偏离窗口中部（或还没建过）时返回 true
+    bool off_center(double best_bid, double best_ask) const;
+    // 以当前中间价为中心从合并簿重建，O(档位数 + ticks)，在调用线程上完成
+    void rebuild(const consolidated_bid_book& bids, const consolidated_ask_book& asks);
+    // 同上，但 strand 上只拷贝档位（O(档位数)），建树交给后台线程；建好之前查询仍用旧窗口，
+    // 这期间的 on_level_changed 记下来，换上新树时重放
+    void begin_rebuild(const consolidated_bid_book& bids, const consolidated_ask_book& asks);
+    // 后台重建完成时换上新树并返回 true；还在建或没有在建时返回 false
+    bool poll_rebuild();
+    bool rebuilding() const { return pending_.valid(); }
+
+    depth_point to_price(book_side side, double price) const;
+    depth_point to_quantity(book_side side, double quantity) const;
+    depth_point to_notional(book_side side, double notional) const;
+
+    // price 是否落在窗口内
+    bool covers(double price) const;
+
+    bool built() const { return built_; }
+    uint64_t rebuilds() const { return rebuilds_; }
+    const depth_index_config& config() const { return cfg_; }
+
+private:
+    struct side_tree {
+        std::vector<double> quantity;
+        std::vector<double> notional;
+    };
+    struct trees {
+        side_tree bid, ask;
+    };
+    using level_list = std::vector<std::pair<double, double>>;   // (价格, 合并总量)，从最优价开始
+    struct level_delta {
+        book_side side;
+        double price;
+        double delta;
+    };
+
+    // 价位在该侧树里的下标：买方从窗口最高价往下，卖方从最低价往上；可能越界
+    static int64_t position_in(const depth_index_config& cfg, int64_t low_tick, book_side side, double price);
+    int64_t position(book_side side, double price) const;
+    // 以 bids / asks 的中间价为中心的窗口起点；两侧都空时返回 false
+    bool center(const consolidated_bid_book& bids, const consolidated_ask_book& asks, int64_t& low_tick) const;
+    void add(book_side side, double price, double delta);
+    static void build_tree(const depth_index_config& cfg, int64_t low_tick, side_tree& tree, book_side side,
+                           const level_list& levels);
+    double price_at(book_side side, int64_t pos) const;
+    depth_point point_at(book_side side, int64_t pos) const;
+    depth_point search(book_side side, bool by_notional, double threshold) const;
+
+    depth_index_config cfg_;
+    side_tree bid_, ask_;
+    int64_t low_tick_ = 0;      // 窗口最低价对应的网格编号
+    bool built_ = false;
+    uint64_t rebuilds_ = 0;
+
+    // 后台重建：spare_ 是上次换下来的树，下次重建时交给后台线程复用，不用重新分配
+    trees spare_;
+    std::future<trees> pending_;
+    int64_t pending_low_tick_ = 0;
+    std::vector<level_delta> pending_deltas_;   // 拷贝档位之后发生的变化
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// asio 回调状态（异步读写、定时器、post 的 lambda）的回收内存：
+// 按 64 字节分级的空闲链表，释放的块挂回链表，稳态下不再走全局 new/delete
+// 同一个连接器的操作可能在不同 io 线程上完成和释放，所以加一把（基本无竞争的）锁
+class handler_memory {
+public:
+    handler_memory() = default;
+    ~handler_memory();
+
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* p, std::size_t bytes);
+
+    // 走了全局 new 的次数（新块或超过 MAX_POOLED 的大块），稳态下应当不再增长
+    std::size_t upstream_allocations() const { return upstream_allocations_; }
+
+private:
+    static constexpr std::size_t GRANULE = 64;
+    static constexpr std::size_t MAX_POOLED = 4096;
+
+    struct free_node { free_node* next; };
+
+    std::mutex mutex_;
+    free_node* free_[MAX_POOLED / GRANULE] = {};
+    std::vector<void*> blocks_;   // 分出去过的所有池化块，析构时释放
+    std::size_t upstream_allocations_ = 0;
+};
+
+// 作为回调的 associated allocator；持有 shared_ptr，io_context 析构时才销毁的回调也能安全归还内存
+template <class T>
+class handler_allocator {
+public:
+    using value_type = T;
+
+    explicit handler_allocator(std::shared_ptr<handler_memory> mem) noexcept : mem_(std::move(mem)) {}
+
+    template <class U>
+    handler_allocator(const handler_allocator<U>& other) noexcept : mem_(other.mem_) {}
+
+    T* allocate(std::size_t n) { return static_cast<T*>(mem_->allocate(sizeof(T) * n)); }
+    void deallocate(T* p, std::size_t n) { mem_->deallocate(p, sizeof(T) * n); }
+
+    template <class U>
+    bool operator==(const handler_allocator<U>& other) const noexcept { return mem_ == other.mem_; }
+    template <class U>
+    bool operator!=(const handler_allocator<U>& other) const noexcept { return mem_ != other.mem_; }
+
+private:
+    template <class> friend class handler_allocator;
+    std::shared_ptr<handler_memory> mem_;
+};
+
+// 包一层回调，让 asio / beast 用 handler_memory 分配这次操作的状态
+template <class Handler>
+class recycled_handler {
+public:
+    using allocator_type = handler_allocator<Handler>;
+
+    recycled_handler(std::shared_ptr<handler_memory> mem, Handler h)
+        : mem_(std::move(mem)), handler_(std::move(h)) {}
+
+    allocator_type get_allocator() const noexcept { return allocator_type(mem_); }
+
+    template <class... Args>
+    void operator()(Args&&... args) { handler_(std::forward<Args>(args)...); }
+
+private:
+    std::shared_ptr<handler_memory> mem_;
+    Handler handler_;
+};
+
+template <class Handler>
+recycled_handler<std::decay_t<Handler>> recycle(const std::shared_ptr<handler_memory>& mem, Handler&& h) {
+    return recycled_handler<std::decay_t<Handler>>(mem, std::forward<Handler>(h));
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 每条线路的到达统计
+struct line_stats {
+    uint64_t messages = 0;       // 带序列号的消息数
+    uint64_t wins = 0;           // 先到、被应用的消息数
+    uint64_t duplicates = 0;     // 后到被丢弃的消息数
+    uint64_t lead_ns_total = 0;  // 先到时领先另一条线路的时间之和（只统计对方也到了的消息）
+    uint64_t lead_samples = 0;
+    uint64_t max_lead_ns = 0;
+};
+
+// 同一交易所多条 websocket（A/B 线）按交易所序列号做先到先用的去重
+// 只在 io 线程上使用
+class line_arbiter {
+public:
+    explicit line_arbiter(std::size_t lines = 1);
+
+    std::size_t lines() const { return stats_.size(); }
+
+    // true = 这个序列号第一次到达，应当应用；false = 其它线路已经送达过
+    bool accept(std::size_t line, uint64_t seq, int64_t now_ns);
+    // 收到快照类消息时调用：忘掉之前的序列号，下一次 accept 以它为新基准
+    // （交易所重启后会重发快照，序列号从头开始）
+    void reset();
+
+    const line_stats& stats(std::size_t line) const { return stats_[line]; }
+    uint64_t last_seq() const { return last_seq_; }
+
+private:
+    struct arrival {
+        uint64_t seq = 0;
+        int64_t ns = 0;
+        std::size_t line = 0;
+    };
+
+    // 最近 HISTORY 个序列号的首次到达记录，用来算落后线路的延迟
+    static constexpr std::size_t HISTORY = 1024;
+    // 连续这么多条比 last_seq_ 旧且不在历史里的消息，认为交易所重置了序列号
+    static constexpr int STALE_RESET = 50;
+
+    std::vector<line_stats> stats_;
+    std::array<arrival, HISTORY> history_{};
+    uint64_t last_seq_ = 0;
+    int stale_run_ = 0;
+};
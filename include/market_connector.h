@@ -5,14 +5,47 @@
 #include <boost/beast/websocket/ssl.hpp>  // 必须，用于 SSL + WebSocket
 #include <boost/beast/ssl.hpp>            // beast::get_lowest_layer 等
 #include <boost/system/error_code.hpp>
+#include <array>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <memory>
 #include <chrono>
 #include <map>
+#include <thread>
+#include <vector>
+#include "order_book.h"
+#include "line_arbiter.h"
+#include "handler_memory.h"
+#include "rx_timestamp_stream.h"
 
 class Aggregator;  // Forward declaration
 
+// 各交易所的心跳方式（由 venue traits 在编译期给出）
+enum class ping_kind {
+    none,
+    ws_ping,        // websocket 控制帧 ping（Binance）
+    json_op,        // {"op": "ping"}（OKX / Bybit）
+    json_op_ts,     // {"op":"ping","ts":...}（Bitget）
+};
+
+// 每个连接器的流量 / CPU 计数，只在 io 线程上更新
+struct feed_stats {
+    uint64_t messages = 0;
+    uint64_t reconnects = 0;
+    uint64_t tls_resumed = 0;     // 复用了上次 TLS 会话的握手次数
+    int64_t last_gap_ms = 0;      // 最近一次断线到重连后第一份簿的时间
+    int64_t max_gap_ms = 0;
+    uint64_t wire_bytes = 0;      // 从 socket 读到的字节（TLS 密文，压缩后）
+    uint64_t payload_bytes = 0;   // 解压后的 websocket 消息字节
+    uint64_t read_cpu_ns = 0;     // 发起读到回调之间 io 线程的 CPU（TLS 解密 + inflate；同线程其它连接器的回调也会算进来）
+    uint64_t read_cpu_samples = 0;    // 计入 read_cpu_ns 的消息数：发起读和回调不在同一线程时两个线程时钟不能相减，跳过
+    uint64_t parse_cpu_ns = 0;    // parse_message + 差分
+    uint64_t parse_errors = 0;    // 解析抛异常的消息数
+    uint64_t rx_delay_ns = 0;     // 内核接收时间戳到 on_read 的累计时间（网卡之后、本进程之内的排队）
+    uint64_t max_rx_delay_ns = 0;
+};
+
 namespace net   = boost::asio;
 namespace beast = boost::beast;
 namespace http  = beast::http;
@@ -21,6 +54,8 @@ namespace ssl   = boost::asio::ssl;
 using tcp = net::ip::tcp;
 
 class market_connector : public std::enable_shared_from_this<market_connector> {
+    friend struct test_access;   // src/tests.cpp
+
 public:
     using event_callback = std::function<void(const std::string&, const std::string&)>;
 
@@ -29,21 +64,71 @@ public:
     market_connector(net::io_context& ioc, Aggregator* aggregator, std::string name,
                    std::string host, std::string port, std::string path, event_callback cb);
     
-    virtual ~market_connector() = default;
+    virtual ~market_connector();
 
     void start();
+
+    // SO_BUSY_POLL（微秒），在下一次 TCP 连接建立时生效；0 = 不设置
+    void set_socket_busy_poll(int usec) { socket_busy_poll_us_ = usec; }
+
+    // permessage-deflate，在下一次 websocket 握手时协商；交易所不支持时退回不压缩
+    void set_compression(bool enable) { compression_ = enable; }
+    bool compression_active() const { return compression_active_; }
+    // stats() / arbiter() 只在 strand() 上读（GetStats 把读取 post 过来）
+    const feed_stats& stats() const { return stats_; }
+    net::strand<net::io_context::executor_type>& strand() { return strand_; }
+
+    // 本连接器的异步读写、心跳定时器和 post 的回调状态都从这里分配；Aggregator 接收变化的 post 也用它
+    const std::shared_ptr<handler_memory>& handler_mem() const { return handler_mem_; }
+
+    // A/B 冗余线路：line > 0 的连接器只收消息，交给主线路按交易所序列号去重后解析
+    void set_primary(market_connector* primary, std::size_t line) { primary_ = primary; line_ = line; }
+    std::size_t line() const { return line_; }
+    void set_line_count(std::size_t lines) { arbiter_ = line_arbiter(lines); }
+    const line_arbiter& arbiter() const { return arbiter_; }
+
+    // Aggregator 分配的 venue id（合并簿中各交易所分量的下标）
+    void set_venue_id(std::size_t id) { venue_id_ = id; }
+    std::size_t venue_id() const { return venue_id_; }
+    const std::string& name() const { return name_; }
     // 新增 public getter（const 引用，避免拷贝）
+    // 本地簿只在本连接器的 strand 上读写；Aggregator 只通过 on_book_updated 收到的变化列表更新合并簿
     const auto& get_bids() const { return local_bids_; }
     const auto& get_asks() const { return local_asks_; }
     
+    // 不做完整 JSON 解析，直接取 "key": 后面的整数（兼容带引号的数字）
+    static uint64_t find_uint_field(const std::string& msg, const char* key);
+
 protected:
+    // 交易所相关的部分由 venue_connector<Venue> 实现（见 venue_connector.h）
     virtual std::string subscription_message() const = 0;
-    virtual void handle_message(const std::string& msg) = 0;
-
-    virtual void parse_message(const std::string& msg) = 0;  // Subclass implements parsing
+    // 一条消息（line = 收到它的线路）；每条消息只有这一次虚调用
+    virtual void deliver(std::size_t line, const std::string& msg) = 0;
+    // 消息里的交易所序列号，多线路去重用；0 = 没有序列号（订阅确认等）
+    virtual uint64_t sequence_id(const std::string& /*msg*/) const { return 0; }
 
     virtual void fail(const boost::system::error_code& ec, const char* what);
 
+    // deliver() 用：多线路时先按序列号去重，true = 应当解析
+    bool redundant() const { return arbiter_.lines() > 1; }
+    // reset = 快照类消息，先让仲裁器忘掉旧序列号
+    bool accept_line(std::size_t line, uint64_t seq, bool reset = false);
+    // 一条消息解析完：收尾快照、记录重连恢复、把档位变化交给 Aggregator
+    void finish_message();
+    // 交易所 parse() 捕获到异常时调用
+    void note_parse_error() { ++stats_.parse_errors; }
+
+    // parse_message 只通过这几个函数改本地簿，同时记录交给 Aggregator 的档位变化
+    // 增量：set_level(side, price, qty)，qty == 0 删除
+    // 全量快照：begin_snapshot() -> set_level()... -> end_snapshot()，只上报与旧簿的差异
+    void set_level(book_side side, double price, double qty);
+    void begin_snapshot();
+    void end_snapshot();
+    // 快照没有走到 end_snapshot()（解析中途抛异常）：丢掉重建了一半的新簿和它的变化，恢复旧簿
+    void abort_snapshot();
+    // 逐笔成交：与档位变化一起在 finish_message() 交给 Aggregator
+    void add_trade(book_side aggressor, double price, double qty, int64_t exchange_ts_ms, uint64_t trade_id);
+
     Aggregator* aggregator_;  // To notify on update
 
     net::io_context& ioc_;
@@ -53,21 +138,74 @@ protected:
     std::string path_;
     event_callback callback_;
 
+    // 本连接器所有 I/O、定时器回调都跑在这个 strand 上：io_threads > 1 时各连接器并行解析，
+    // 同一连接器的读回调、心跳、重连彼此串行
+    net::strand<net::io_context::executor_type> strand_;
     tcp::resolver resolver_;
     ssl::context ssl_ctx_;
-    websocket::stream<ssl::stream<beast::tcp_stream>> ws_;
+    // 每次连接新建一个 stream：SSL 对象出错后不能复用
+    // TLS 下面是 rx_timestamp_stream：每次 socket 读都带回内核接收时间
+    using ws_stream = websocket::stream<ssl::stream<rx_timestamp_stream>>;
+    std::unique_ptr<ws_stream> ws_;
     beast::flat_buffer buffer_;
+    std::shared_ptr<handler_memory> handler_mem_ = std::make_shared<handler_memory>();
     
     bool stopped_ = false;
-    
-    // net::strand<net::io_context::executor_type> strand_;
+    ping_kind ping_ = ping_kind::none;
 
-    std::map<double, double, std::greater<double>> local_bids_;
-    std::map<double, double> local_asks_;
+    // 档位节点从本连接器的内存池分配（book_mem_ 必须声明在两本 book 之前）
+    book_memory book_mem_;
+    bid_book local_bids_;
+    ask_book local_asks_;
+
+    // 快照期间保存旧簿，end_snapshot() 时与新簿做差
+    bid_book prev_bids_;
+    ask_book prev_asks_;
+    bool in_snapshot_ = false;
+    std::size_t snapshot_changes_from_ = 0;     // 本次快照的变化在 pending_changes_ 里的起点
+
+    std::size_t venue_id_ = 0;
+    std::vector<level_change> pending_changes_;  // 本条消息产生的变化，handle_message 后交给 Aggregator
+    int64_t msg_rx_ns_ = 0;                      // 正在解析的消息的内核接收时间，随变化一起交给 Aggregator
+    std::vector<trade_print> pending_trades_;    // 本条消息里的成交
+    // 多线路时最近收到的成交号（环形），成交没有序列号，靠它去掉另一条线路上的重复
+    std::array<uint64_t, 512> recent_trade_ids_{};
+    std::size_t recent_trade_pos_ = 0;
 
 private:
     int retry_count_ = 0;
+
+    // 快速重连：复用上次解析出的地址和 TLS 会话，断线到第一份簿的时间记进 stats_
+    std::unique_ptr<ws_stream> retired_ws_;     // 上一条连接，留到下次重连再释放，避免回调悬空
+    tcp::resolver::results_type endpoints_;
+    SSL_SESSION* tls_session_ = nullptr;
+    std::chrono::steady_clock::time_point disconnected_at_;
+    bool awaiting_first_book_ = false;
+
+    static int on_new_tls_session(SSL* ssl, SSL_SESSION* session);
+    void do_connect();
+    void deliver_timed(std::size_t line, const std::string& msg, int64_t rx_ns);
+    void note_first_book();
+    int socket_busy_poll_us_ = 0;
+    bool compression_ = false;
+    bool compression_active_ = false;   // 服务端在握手响应里接受了 permessage-deflate
+    websocket::response_type handshake_res_;
+
+    feed_stats stats_;
+    uint64_t wire_bytes_mark_ = 0;      // 上次统计时 SSL rbio 的累计读字节
+    uint64_t read_cpu_mark_ = 0;        // 发起 async_read 时的线程 CPU 时间
+    std::thread::id read_thread_;       // 发起 async_read 的线程，read_cpu_mark_ 是它的时钟
+    uint64_t stats_logged_at_ = 0;      // 上次打印统计时的消息数
+
+    void update_read_stats(std::size_t bytes_transferred);
+
+    market_connector* primary_ = nullptr;   // 非空 = 本连接器是备线
+    std::size_t line_ = 0;
+    line_arbiter arbiter_;                  // 主线路上记录各线路的先到统计
+
+
     net::steady_timer ping_timer_;
+    std::string ping_payload_;
     net::steady_timer reconnect_timer_;
     net::steady_timer handshake_timer_;
 
@@ -1,22 +1,24 @@
 #pragma once
-#include "market_connector.h"
+#include "venue_connector.h"
 
-class Aggregator;
+// OKX books5：订阅后每条都是前 5 档全量；同一连接上订阅 trades 逐笔成交
+struct okx_venue {
+    static constexpr const char* name = "OKX";
+    static constexpr ping_kind ping = ping_kind::json_op;
 
-class okx_connector : public market_connector {
-public:
-    // okx_connector(net::io_context& ioc, event_callback cb);
-    okx_connector(net::io_context& ioc,
-                  Aggregator* aggregator,
-                  std::string name,
-                  std::string host,
-                  std::string port,
-                  std::string path,
-                  event_callback cb);
-
-protected:
-    std::string subscription_message() const override;
-    void handle_message(const std::string& msg) override;
-
-    void parse_message(const std::string& msg) override;
+    static std::string subscription_message() {
+        return R"({
+        "op":"subscribe",
+        "args":[{"channel":"books5","instId":"BTC-USDT"},{"channel":"trades","instId":"BTC-USDT"}]
+    })";
+    }
+    // 多线路去重用：books 频道的 seqId（成交没有，add_trade 按成交号去重）
+    static uint64_t sequence_id(const std::string& msg) {
+        return market_connector::find_uint_field(msg, "seqId");
+    }
+    static bool sequence_reset(const std::string&) { return false; }
+    static void parse(venue_connector<okx_venue>& c, const std::string& msg);
 };
+
+extern template class venue_connector<okx_venue>;
+using okx_connector = venue_connector<okx_venue>;
@@ -0,0 +1,131 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// 订单簿容器：节点从每本订单簿自己的内存池分配，
+// 档位插入/删除以及 clear() 后重建都不再走全局 new/delete
+using bid_book = std::pmr::map<double, double, std::greater<double>>;
+using ask_book = std::pmr::map<double, double>;
+
+// venue id = 交易所在配置里的顺序，合并簿按它索引各交易所分量
+constexpr std::size_t MAX_VENUES = 8;
+
+enum class book_side : uint8_t { bid, ask };
+
+// connector 交给 Aggregator 的档位变化：数量是该交易所在此价位的新绝对值，0 = 删除
+struct level_change {
+    book_side side;
+    double price;
+    double qty;
+};
+
+// connector 交给 Aggregator 的逐笔成交，各交易所 trade 频道归一化后的格式
+struct trade_print {
+    double price = 0.0;
+    double qty = 0.0;
+    int64_t exchange_ts_ms = 0;   // 交易所的成交时间
+    int64_t rx_ns = 0;            // 所在消息的内核接收时间（0 = 没有）
+    uint64_t trade_id = 0;        // 交易所成交 id
+    uint32_t venue = 0;
+    book_side aggressor = book_side::bid;   // 主动方：bid = 买方主动
+};
+
+// 一个交易所（或合并后）的最优买卖价；数量为 0 表示该侧为空
+struct top_of_book {
+    double bid_price = 0.0;
+    double bid_qty = 0.0;
+    double ask_price = 0.0;
+    double ask_qty = 0.0;
+
+    bool operator==(const top_of_book& o) const {
+        return bid_price == o.bid_price && bid_qty == o.bid_qty && ask_price == o.ask_price && ask_qty == o.ask_qty;
+    }
+    bool operator!=(const top_of_book& o) const { return !(*this == o); }
+};
+
+// 合并簿的一个档位：总量 + 各交易所分量
+struct venue_level {
+    double total = 0.0;
+    std::array<double, MAX_VENUES> by_venue{};
+};
+
+using consolidated_bid_book = std::pmr::map<double, venue_level, std::greater<double>>;
+using consolidated_ask_book = std::pmr::map<double, venue_level>;
+
+// 把某交易所一个档位的新数量写进合并簿：只动这一个价位，不遍历任何交易所的簿
+// total 每次由分量重新求和，避免增减累积浮点误差；分量全为 0 时删除该档
+// 返回该档总量的变化（新 total - 旧 total），供增量索引使用
+template <class Book>
+double apply_venue_level(Book& book, std::size_t venue, double price, double qty) {
+    auto it = book.find(price);
+    if (it == book.end()) {
+        if (qty <= 0.0) return 0.0;
+        it = book.emplace(price, venue_level{}).first;
+    }
+
+    auto& lvl = it->second;
+    const double old_total = lvl.total;
+    lvl.by_venue[venue] = qty > 0.0 ? qty : 0.0;
+
+    double total = 0.0;
+    for (double q : lvl.by_venue) total += q;
+    if (total <= 0.0) {
+        book.erase(it);
+        return -old_total;
+    }
+    lvl.total = total;
+    return total - old_total;
+}
+
+// 按大小分级的空闲链表：释放的节点挂回链表，下次同尺寸分配直接复用，O(1)
+// 内存只在析构时归还上游（订单簿档位数有上限，不会无限增长）
+class free_list_resource : public std::pmr::memory_resource {
+public:
+    explicit free_list_resource(std::pmr::memory_resource* upstream);
+    ~free_list_resource() override;
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+private:
+    static constexpr std::size_t GRANULE = 16;
+    static constexpr std::size_t MAX_POOLED = 256;
+    static constexpr std::size_t CHUNK_BYTES = 64 * 1024;
+
+    struct free_node { free_node* next; };
+    struct chunk { void* ptr; std::size_t bytes; };
+
+    std::pmr::memory_resource* upstream_;
+    free_node* free_[MAX_POOLED / GRANULE] = {};
+    char* cursor_ = nullptr;   // 当前 chunk 中未切分部分
+    char* end_ = nullptr;
+    std::vector<chunk> chunks_;
+};
+
+// 每本订单簿私有的内存池（只在单个线程 / strand 上使用，不加锁）
+class book_memory {
+public:
+    book_memory();
+    ~book_memory();
+
+    book_memory(const book_memory&) = delete;
+    book_memory& operator=(const book_memory&) = delete;
+
+    std::pmr::memory_resource* resource() { return &pool_; }
+
+    // 进程级开关：之后新建的 book_memory 以大页 (2MB) 作为上游内存，
+    // 必须在创建 connector / Aggregator 之前调用
+    static void use_huge_pages(bool enable);
+
+private:
+    std::unique_ptr<std::pmr::memory_resource> upstream_;  // 大页上游，未开启时为空
+    free_list_resource pool_;
+};
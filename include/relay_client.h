@@ -0,0 +1,61 @@
+#pragma once
+#include <grpcpp/grpcpp.h>
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "aggregator.grpc.pb.h"
+
+// exchanges.json 里 "relay" 段：upstream 非空时本进程不连交易所，改为订阅上游 aggregator
+struct relay_config {
+    std::string upstream;        // 上游 gRPC 地址，如 "10.0.0.5:50051"；空 = 不是 relay
+    bool trades = true;          // 同时转发 SubscribeTrades
+    int max_backoff_ms = 5000;   // 断线重连的最长退避
+};
+
+relay_config parse_relay_config(const nlohmann::json& j);
+
+// 分层扇出：订阅上游的 SubscribeBook（with_venues）和 SubscribeTrades，收到的消息交给回调
+// 每条流一个线程，断线后退避重连；回调在这些线程上执行
+class relay_client {
+public:
+    using book_callback = std::function<void(aggregator::BookUpdate&)>;
+    using trades_callback = std::function<void(const aggregator::TradeBatch&)>;
+
+    relay_client(relay_config cfg, book_callback on_book, trades_callback on_trades);
+    ~relay_client();
+
+    // 阻塞直到从上游读到一份簿（启动时用它确定交易所列表）；stop() 之后返回 false
+    bool fetch_book(aggregator::BookUpdate& out);
+    void start();
+    void stop();
+
+    const relay_config& config() const { return cfg_; }
+
+private:
+    template <class Message, class Open, class Handle>
+    void run_stream(const char* what, Open open, Handle handle);
+
+    // 登记正在读的流，stop() 时取消它；已停止时返回 false
+    bool track(grpc::ClientContext* context);
+    void untrack(grpc::ClientContext* context);
+    // 按指数退避等待，期间 stop() 会立即唤醒；已停止时返回 false
+    bool wait_backoff(int& backoff_ms);
+
+    relay_config cfg_;
+    book_callback on_book_;
+    trades_callback on_trades_;
+    std::shared_ptr<grpc::Channel> channel_;
+    std::unique_ptr<aggregator::AggregatorService::Stub> stub_;
+
+    std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    bool stopped_ = false;                          // 受 mutex_ 保护
+    std::vector<grpc::ClientContext*> contexts_;    // 受 mutex_ 保护
+    std::vector<std::thread> threads_;
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <boost/asio/io_context.hpp>
+#include <nlohmann/json.hpp>
+#include <sched.h>
+#include <vector>
+
+// exchanges.json 里 "runtime" 段：线程绑核、忙轮询等部署相关参数
+// 所有字段可省略，缺省即原来的行为（不绑核、阻塞 run()）
+struct runtime_config {
+    int io_core = -1;                   // 跑 io_context 的线程
+    int io_threads = 1;                 // 跑 io_context 的线程数；> 1 时各连接器在自己的 strand 上并行解析
+    std::vector<int> io_cores;          // io 线程 i 绑到 io_cores[i % size]（非空时代替 io_core）
+    std::vector<int> grpc_cores;        // gRPC server 线程，gRPC 内部线程从它派生、继承同一掩码
+    std::vector<int> publisher_cores;   // SubscribeBook 推送线程，按订阅轮流分配
+    bool busy_poll = false;             // io 线程用 ioc.poll() 自旋代替阻塞的 run()
+    int socket_busy_poll_us = 0;        // 交易所 socket 的 SO_BUSY_POLL（微秒，0 = 不设置）
+    int stats_interval_ms = 0;          // 周期打印 GetStats 的内容（0 = 不打印）
+    int grpc_port = 50051;              // gRPC 监听端口；同一台机器上跑上游和 relay 时要错开
+};
+
+runtime_config parse_runtime_config(const nlohmann::json& j);
+
+// 把当前线程绑到 cores 上（空列表 = 不绑），失败只打印警告
+bool pin_current_thread(const std::vector<int>& cores, const char* who);
+
+// 构造时保存当前线程的 CPU 掩码，析构时恢复：借用线程池的线程临时绑核后还回去
+class scoped_thread_affinity {
+public:
+    scoped_thread_affinity();
+    ~scoped_thread_affinity();
+
+    scoped_thread_affinity(const scoped_thread_affinity&) = delete;
+    scoped_thread_affinity& operator=(const scoped_thread_affinity&) = delete;
+
+private:
+    cpu_set_t saved_;
+    bool valid_ = false;
+};
+
+// 在当前线程驱动 io_context；busy_poll 时自旋直到 ioc.stop()
+void run_io_loop(boost::asio::io_context& ioc, bool busy_poll);
+
+// 编译进来的 asio reactor："io_uring"（-DAGGREGATOR_IO_URING=ON）或 "epoll"
+const char* io_backend_name();
@@ -0,0 +1,102 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/beast/core/bind_handler.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <sys/uio.h>
+#include <cstdint>
+#include "alloc_profile.h"
+
+// 开启 SO_TIMESTAMPING 软件接收时间戳：内核收到数据包时打的 CLOCK_REALTIME 时间
+bool enable_rx_timestamps(int fd);
+
+// 非阻塞 recvmsg，顺带取出控制消息里的接收时间戳（没有时 rx_ns 不变）
+// 没有数据时 ec = would_block，对端关闭时 ec = eof
+std::size_t recv_timestamped(int fd, iovec* iov, std::size_t iov_count, int64_t& rx_ns,
+                             boost::system::error_code& ec);
+
+// 夹在 TLS 和 TCP 之间的一层：读走 recvmsg 拿到内核接收时间，写和连接直接交给 tcp_stream
+// beast::get_lowest_layer 穿过这一层仍然得到 tcp_stream，连接、关闭的代码不用改
+class rx_timestamp_stream {
+public:
+    using next_layer_type = boost::beast::tcp_stream;
+    using lowest_layer_type = next_layer_type::socket_type;
+    using executor_type = next_layer_type::executor_type;
+
+    template <class Executor>
+    explicit rx_timestamp_stream(Executor&& ex) : stream_(std::forward<Executor>(ex)) {}
+
+    executor_type get_executor() noexcept { return stream_.get_executor(); }
+    next_layer_type& next_layer() noexcept { return stream_; }
+    const next_layer_type& next_layer() const noexcept { return stream_; }
+    lowest_layer_type& lowest_layer() noexcept { return stream_.socket(); }
+    const lowest_layer_type& lowest_layer() const noexcept { return stream_.socket(); }
+
+    // 最近一次从 socket 读到数据时的内核接收时间（ns，0 = 没开启或内核没给）
+    // 一次读进来的多条 websocket 消息共用这个时间，它们本来就是同一批到达的
+    int64_t last_rx_ns() const { return last_rx_ns_; }
+
+    template <class ConstBufferSequence, class WriteHandler>
+    auto async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler) {
+        return stream_.async_write_some(buffers, std::forward<WriteHandler>(handler));
+    }
+
+    template <class MutableBufferSequence, class ReadHandler>
+    auto async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler) {
+        return boost::asio::async_compose<ReadHandler, void(boost::system::error_code, std::size_t)>(
+            read_op<MutableBufferSequence>{*this, buffers}, handler, stream_.socket());
+    }
+
+private:
+    static constexpr std::size_t MAX_IOV = 16;
+
+    // 先直接 recvmsg，没数据再 async_wait(wait_read) 等 reactor 通知
+    template <class MutableBufferSequence>
+    struct read_op {
+        rx_timestamp_stream& s;
+        MutableBufferSequence buffers;
+        enum { starting, waiting, done } state = starting;
+
+        template <class Self>
+        void operator()(Self& self, boost::system::error_code ec = {}, std::size_t n = 0) {
+            if (state != done) {
+                if (!ec) n = s.read_now(buffers, ec);
+                if (ec == boost::asio::error::would_block) {
+                    state = waiting;
+                    s.stream_.socket().async_wait(lowest_layer_type::wait_read, std::move(self));
+                    return;
+                }
+                if (state == starting) {
+                    // 数据已经在 socket 里：不能在发起函数里直接回调
+                    state = done;
+                    boost::asio::post(boost::beast::bind_front_handler(std::move(self), ec, n));
+                    return;
+                }
+            }
+            // 上层的 TLS 解密、beast 读帧 / inflate 和 on_read 都在这次完成回调里同步跑，记到 read
+            alloc_scope scope(alloc_stage::read);
+            self.complete(ec, n);
+        }
+    };
+
+    template <class MutableBufferSequence>
+    std::size_t read_now(const MutableBufferSequence& buffers, boost::system::error_code& ec) {
+        iovec iov[MAX_IOV];
+        std::size_t count = 0;
+        for (auto it = boost::asio::buffer_sequence_begin(buffers);
+             it != boost::asio::buffer_sequence_end(buffers) && count < MAX_IOV; ++it) {
+            boost::asio::mutable_buffer b(*it);
+            if (b.size() == 0) continue;
+            iov[count].iov_base = b.data();
+            iov[count].iov_len = b.size();
+            ++count;
+        }
+        if (count == 0) {
+            ec = {};
+            return 0;
+        }
+        return recv_timestamped(stream_.socket().native_handle(), iov, count, last_rx_ns_, ec);
+    }
+
+    next_layer_type stream_;
+    int64_t last_rx_ns_ = 0;
+};
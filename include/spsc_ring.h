@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// 单生产者 / 单消费者的定长环：容量取 2 的幂，缓冲区构造时一次分配，之后不再分配
+// head_ 只由消费者写、tail_ 只由生产者写，各占一条缓存行；双方各自缓存对方的下标，
+// 只有看起来满 / 空时才去读对方的原子变量
+template <class T>
+class spsc_ring {
+public:
+    explicit spsc_ring(std::size_t capacity) {
+        std::size_t n = 1;
+        while (n < capacity) n *= 2;
+        buf_.resize(n);
+        mask_ = n - 1;
+    }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    std::size_t capacity() const { return buf_.size(); }
+
+    // 生产者：n 个元素全部放得下才写入，否则什么都不做返回 false
+    bool try_push(const T* items, std::size_t n) {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail + n - cached_head_ > buf_.size()) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail + n - cached_head_ > buf_.size()) return false;
+        }
+        for (std::size_t i = 0; i < n; ++i) buf_[(tail + i) & mask_] = items[i];
+        tail_.store(tail + n, std::memory_order_release);
+        return true;
+    }
+
+    bool try_push(const T& item) { return try_push(&item, 1); }
+
+    // 生产者：还能放下 n 个元素
+    bool has_space(std::size_t n) {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail + n - cached_head_ <= buf_.size()) return true;
+        cached_head_ = head_.load(std::memory_order_acquire);
+        return tail + n - cached_head_ <= buf_.size();
+    }
+
+    // 消费者
+    bool try_pop(T& out) {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) return false;
+        }
+        out = buf_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 消费者：把接下来的 n 个元素追加到 out（调用方保证已经写入，例如先读到了描述它们的消息）
+    void pop_into(std::vector<T>& out, std::size_t n) {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (cached_tail_ - head < n) cached_tail_ = tail_.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < n; ++i) out.push_back(buf_[(head + i) & mask_]);
+        head_.store(head + n, std::memory_order_release);
+    }
+
+    // 消费者
+    bool empty() {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head != cached_tail_) return false;
+        cached_tail_ = tail_.load(std::memory_order_acquire);
+        return head == cached_tail_;
+    }
+
+private:
+    std::vector<T> buf_;
+    std::size_t mask_ = 0;
+
+    alignas(64) std::atomic<std::size_t> head_{0};   // 消费者写
+    std::size_t cached_tail_ = 0;                     // 消费者私有
+    alignas(64) std::atomic<std::size_t> tail_{0};   // 生产者写
+    std::size_t cached_head_ = 0;                     // 生产者私有
+};
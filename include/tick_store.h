@@ -0,0 +1,133 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "order_book.h"
+
+// exchanges.json 里 "tick_store" 段；dir 为空表示不记录
+struct tick_store_config {
+    std::string dir;
+    std::string symbol = "BTCUSDT";
+    std::size_t depth = 20;     // 每侧记录的档数
+};
+
+tick_store_config parse_tick_store_config(const nlohmann::json& j);
+
+// 内存映射的定长记录列文件：64 字节头 + rows * record_bytes
+// 写端每追加完一整行（所有列）才更新头里的 rows，读端以各列 rows 的最小值为准
+class column_file {
+public:
+    column_file() = default;
+    ~column_file();
+
+    column_file(const column_file&) = delete;
+    column_file& operator=(const column_file&) = delete;
+
+    bool open_append(const std::string& path, uint32_t record_bytes);
+    bool open_read(const std::string& path);
+    void close();
+
+    // 保证还能再追加一行（需要时扩文件）；失败时什么都不改
+    bool reserve();
+    bool append(const void* record);
+    void commit();  // 把已追加的行数写进文件头
+    // 丢掉 rows 之后的行（重启时把各列对齐到最短的一列）
+    void truncate(uint64_t rows);
+
+    uint64_t rows() const;
+    uint32_t record_bytes() const { return record_bytes_; }
+    const void* record(uint64_t row) const;
+
+private:
+    bool map(std::size_t bytes);
+
+    int fd_ = -1;
+    char* base_ = nullptr;
+    std::size_t mapped_ = 0;
+    uint64_t rows_ = 0;
+    uint32_t record_bytes_ = 0;
+    bool writable_ = false;
+};
+
+// 按 symbol / UTC 日期分区追加合并簿版本：<dir>/<symbol>/<YYYYMMDD>/*.col
+// 列：ts（ns）、seq（版本号）、bid_px / bid_qty / ask_px / ask_qty（每行 depth 个 double，缺档补 0）
+// append 只把前 depth 档拷进队列，扩文件、换日分区等磁盘操作都在自己的写线程里
+class tick_store {
+public:
+    explicit tick_store(tick_store_config cfg);
+    ~tick_store();   // 队列里剩下的行写完再退出
+
+    tick_store(const tick_store&) = delete;
+    tick_store& operator=(const tick_store&) = delete;
+
+    void append(int64_t ts_ns, uint64_t seq,
+                const consolidated_bid_book& bids, const consolidated_ask_book& asks);
+    // 等写线程把已经交进来的行都写完
+    void flush();
+
+    // 写线程跟不上时队列最多攒这么多行，再多的丢掉并记日志
+    static constexpr std::size_t MAX_QUEUED_ROWS = 64 * 1024;
+
+private:
+    // 一批待写的行：levels 每行 4 * depth 个 double，依次为 bid_px、bid_qty、ask_px、ask_qty
+    struct row_batch {
+        std::vector<int64_t> ts;
+        std::vector<uint64_t> seq;
+        std::vector<double> levels;
+
+        void clear() { ts.clear(); seq.clear(); levels.clear(); }
+    };
+
+    void run_writer();
+    void write_row(int64_t ts_ns, uint64_t seq, const double* levels);
+    bool roll(int64_t day);
+
+    tick_store_config cfg_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;        // 有新行或要求退出
+    std::condition_variable done_cv_;   // 写线程写完一批
+    row_batch queued_;                  // 受 mutex_ 保护
+    uint64_t dropped_ = 0;              // 受 mutex_ 保护：队列满时丢掉的行
+    bool writing_ = false;              // 受 mutex_ 保护：写线程正在写 batch_
+    bool stop_ = false;                 // 受 mutex_ 保护
+
+    // 以下只在写线程访问
+    row_batch batch_;                   // 和 queued_ 交换，两边都保留容量
+    int64_t day_ = -1;   // 当前分区（自 epoch 起的天数）
+    bool ok_ = false;
+    column_file ts_, seq_, bid_px_, bid_qty_, ask_px_, ask_qty_;
+
+    std::thread writer_;
+};
+
+// 离线读取一个分区
+class tick_reader {
+public:
+    bool open(const std::string& dir, const std::string& symbol, const std::string& yyyymmdd);
+
+    uint64_t rows() const { return rows_; }
+    std::size_t depth() const { return depth_; }
+
+    int64_t ts(uint64_t row) const;
+    uint64_t seq(uint64_t row) const;
+    const double* bid_px(uint64_t row) const;
+    const double* bid_qty(uint64_t row) const;
+    const double* ask_px(uint64_t row) const;
+    const double* ask_qty(uint64_t row) const;
+
+    // 第一条 ts >= ts_ns 的行（ts 列单调递增，二分）
+    uint64_t lower_bound(int64_t ts_ns) const;
+
+private:
+    column_file ts_, seq_, bid_px_, bid_qty_, ask_px_, ask_qty_;
+    uint64_t rows_ = 0;
+    std::size_t depth_ = 0;
+};
+
+// UTC 日期分区名
+std::string tick_partition_name(int64_t ts_ns);
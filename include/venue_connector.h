@@ -0,0 +1,54 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "market_connector.h"
+
+// 交易所差异用编译期 traits 描述，Venue 需要提供：
+//   static constexpr const char* name;          配置里的交易所名
+//   static constexpr ping_kind ping;            心跳方式
+//   static std::string subscription_message();  连上后发送的订阅（空 = URL 即订阅）
+//   static uint64_t sequence_id(const std::string& msg);   多线路去重用的序列号
+//   static bool sequence_reset(const std::string& msg);    快照类消息：总是应用，并以它的序列号为新基准
+//   static void parse(venue_connector<Venue>& c, const std::string& msg);  解析并改本地簿
+// 每条消息只有 deliver() 一次虚调用，之后的去重、解析、改簿都在这里静态分派
+template <class Venue>
+class venue_connector final : public market_connector {
+public:
+    venue_connector(net::io_context& ioc, Aggregator* aggregator, std::string name,
+                    std::string host, std::string port, std::string path, event_callback cb)
+        : market_connector(ioc, aggregator, std::move(name), std::move(host), std::move(port),
+                           std::move(path), std::move(cb)) {
+        ping_ = Venue::ping;
+    }
+
+    void parse_message(const std::string& msg) { Venue::parse(*this, msg); }
+
+protected:
+    std::string subscription_message() const override { return Venue::subscription_message(); }
+
+    uint64_t sequence_id(const std::string& msg) const override { return Venue::sequence_id(msg); }
+
+    void deliver(std::size_t line, const std::string& msg) override {
+        if (redundant() && !accept_line(line, Venue::sequence_id(msg), Venue::sequence_reset(msg))) return;
+        parse_message(msg);
+        finish_message();
+    }
+
+private:
+    friend Venue;  // parse() 通过 set_level / begin_snapshot / end_snapshot 改本地簿
+};
+
+// 编译期交易所列表：按配置里的名字创建对应的 venue_connector，未知名字返回空
+template <class... Venues>
+struct venue_list {
+    static std::shared_ptr<market_connector> make(const std::string& name, net::io_context& ioc,
+                                                  Aggregator* aggregator, const std::string& host,
+                                                  const std::string& port, const std::string& path,
+                                                  market_connector::event_callback cb) {
+        std::shared_ptr<market_connector> c;
+        ((c = !c && name == Venues::name
+                  ? std::make_shared<venue_connector<Venues>>(ioc, aggregator, name, host, port, path, cb)
+                  : c), ...);
+        return c;
+    }
+};
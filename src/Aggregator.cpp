@@ -3,6 +3,8 @@
 #include "okx_connector.h"
 // #include "bitget_connector.h"
 #include "bybit_connector.h"
+#include "alloc_profile.h"
+#include <algorithm>
 #include <iostream>
 #include <grpcpp/server_builder.h>
 #include <chrono>
@@ -14,9 +16,32 @@
 
 Aggregator::Aggregator(boost::asio::io_context& ioc)
     : ioc_(ioc),
-      strand_(boost::asio::make_strand(ioc)){}
+      strand_(boost::asio::make_strand(ioc)),
+      consolidated_bids_(book_mem_.resource()),
+      consolidated_asks_(book_mem_.resource()),
+      snapshot_timer_(strand_) {
+    for (auto& h : handoff_) h = std::make_unique<venue_handoff>();
+    handoff_scratch_.reserve(HANDOFF_CHANGES);
+}
 
 Aggregator::~Aggregator() {
+    if (relay_) relay_->stop();
+    if (stats_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(stats_stop_mutex_);
+            stats_stop_ = true;
+        }
+        stats_stop_cv_.notify_all();
+        stats_thread_.join();
+    }
+    if (snapshot_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(snapshot_mutex_);
+            snapshot_stop_ = true;
+        }
+        snapshot_cv_.notify_all();
+        snapshot_thread_.join();   // 还没写的最后一份快照在退出前写完
+    }
     if (grpc_server_) {
         grpc_server_->Shutdown();
     }
@@ -34,105 +59,720 @@ void Aggregator::start(const std::string& config_file_path) {
     nlohmann::json config_json;
     file >> config_json;
 
-    for (const auto& c : config_json) {
+    // 兼容两种格式：旧的纯交易所数组，或 {"runtime": {...}, "exchanges": [...]}
+    nlohmann::json exchanges = config_json;
+    if (config_json.is_object()) {
+        runtime_ = parse_runtime_config(config_json.value("runtime", nlohmann::json::object()));
+        signals_ = book_signals(parse_signal_config(config_json.value("signals", nlohmann::json::object())));
+        snapshot_cfg_ = parse_snapshot_config(config_json.value("snapshot", nlohmann::json::object()));
+
+        auto tick_cfg = parse_tick_store_config(config_json.value("tick_store", nlohmann::json::object()));
+        if (!tick_cfg.dir.empty()) {
+            tick_store_ = std::make_unique<tick_store>(std::move(tick_cfg));
+        }
+        auto history_cfg = parse_history_config(config_json.value("history", nlohmann::json::object()));
+        if (history_cfg.seconds > 0) {
+            history_ = std::make_unique<book_history>(history_cfg);
+        }
+        auto depth_cfg = parse_depth_index_config(config_json.value("depth_index", nlohmann::json::object()));
+        if (depth_cfg.tick > 0.0) {
+            depth_index_ = std::make_unique<depth_index>(depth_cfg);
+        }
+        exchanges = config_json.value("exchanges", nlohmann::json::array());
+
+        relay_config relay_cfg = parse_relay_config(config_json.value("relay", nlohmann::json::object()));
+        if (!relay_cfg.upstream.empty()) {
+            start_relay(std::move(relay_cfg));
+            exchanges = nlohmann::json::array();  // relay 不连交易所
+        }
+    }
+
+    // 编译进来的交易所；Bitget 目前不参与构建（见 CMakeLists.txt）
+    using venues = venue_list<binance_venue, okx_venue, bybit_venue>;
+    auto make_connector = [this](const std::string& name, const std::string& host,
+                                 const std::string& port, const std::string& path) {
+        return venues::make(name, ioc_, this, host, port, path,
+                            [this](const std::string& ex, const std::string& msg) {
+                                on_market_event({ex, msg});
+                            });
+    };
+
+    for (const auto& c : exchanges) {
         std::string name = c["name"];
         std::string host = c["host"];
         std::string port = c["port"];
         std::string path = c["path"];
-        if (name == "Binance") {
-            connectors_.emplace_back(std::make_shared<binance_connector>(
-                ioc_, this, name, host, port, path,
-                [this](const std::string& ex, const std::string& msg) {
-                    on_market_event({ex, msg});
-                }));
-        } else if (name == "OKX") {
-            connectors_.emplace_back(std::make_shared<okx_connector>(
-                ioc_, this, name, host, port, path,
-                [this](const std::string& ex, const std::string& msg) {
-                    on_market_event({ex, msg});
-                }));
-        } else if (name == "Bybit") {
-            connectors_.emplace_back(std::make_shared<bybit_connector>(
-                ioc_, this, name, host, port, path,
-                [this](const std::string& ex, const std::string& msg) {
-                    on_market_event({ex, msg});
-                }));
-        }else {
+        auto connector = make_connector(name, host, port, path);
+        if (!connector) {
             std::cerr << "Unknown connector name: " << name << std::endl;
+            continue;
+        }
+        connectors_.push_back(connector);
+
+        if (connectors_.size() > MAX_VENUES) {
+            throw std::runtime_error("Too many exchanges, at most " + std::to_string(MAX_VENUES));
+        }
+        connectors_.back()->set_venue_id(connectors_.size() - 1);
+        connectors_.back()->set_compression(c.value("compression", false));
+        venue_names_.push_back(name);
+
+        // "lines": N 打开 N 条独立连接，备线的消息交给主线路按序列号先到先用
+        // "backup_hosts" 可以让备线连到不同的入口（按顺序轮流使用），缺省与主线路相同
+        std::size_t lines = std::max<std::size_t>(1, c.value("lines", std::size_t{1}));
+        std::vector<std::string> backup_hosts = c.value("backup_hosts", std::vector<std::string>{});
+        connector->set_line_count(lines);
+        for (std::size_t line = 1; line < lines; ++line) {
+            const std::string& line_host = backup_hosts.empty() ? host : backup_hosts[(line - 1) % backup_hosts.size()];
+            auto backup = make_connector(name, line_host, port, path);
+            backup->set_venue_id(connector->venue_id());
+            backup->set_compression(c.value("compression", false));
+            backup->set_primary(connector.get(), line);
+            backup_lines_.push_back(backup);
         }
     }
 
+    // io 线程尚未运行，这里直接改合并簿是安全的
+    // relay 每次连上游都先收到整本簿，不需要快照
+    if (!snapshot_cfg_.path.empty() && !relay_) {
+        restore_snapshot();
+        schedule_snapshot();
+    }
+
     for (auto& c : connectors_) {
+        c->set_socket_busy_poll(runtime_.socket_busy_poll_us);
+        c->start();
+    }
+    for (auto& c : backup_lines_) {
+        c->set_socket_busy_poll(runtime_.socket_busy_poll_us);
         c->start();
     }
 
-    grpc_thread_ = std::thread([this] { start_grpc_server(); });
+    if (runtime_.stats_interval_ms > 0) {
+        stats_thread_ = std::thread([this] { run_stats_dump(); });
+    }
+
+    grpc_thread_ = std::thread([this] {
+        // 先绑核再启动 server：gRPC 内部线程由这个线程创建，继承同一 CPU 掩码
+        pin_current_thread(runtime_.grpc_cores, "gRPC");
+        start_grpc_server();
+    });
 }
 
 void Aggregator::on_market_event(const market_event& evt) {
     std::cout << "[" << evt.exchange << "] Raw: " << evt.message << std::endl;
 }
 
-// connector 回调时调用这个（异步 post）
-void Aggregator::on_book_updated(market_connector* connector) {
-    // 把实际更新操作 post 到 strand，保证串行、无锁
-    boost::asio::post(strand_, [this, connector]() {
-        update_consolidated_book(connector);
+// connector 回调时调用这个（在 connector 的 strand 上）
+void Aggregator::on_book_updated(market_connector* connector, const std::vector<level_change>& changes,
+                                 top_of_book top, int64_t rx_ns) {
+    // 实际更新在 strand 上串行执行；strand 上不再读 connector 的本地簿
+    int64_t depth = strand_queue_.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (depth > max_strand_queue_.load(std::memory_order_relaxed)) {
+        max_strand_queue_.store(depth, std::memory_order_relaxed);  // 多个 connector 线程竞争时是近似值
+    }
+
+    const std::size_t venue = connector->venue_id();
+    venue_handoff& h = *handoff_[venue];
+    if (h.fallback_inflight.load(std::memory_order_acquire) == 0 && h.messages.has_space(1) &&
+        h.changes.try_push(changes.data(), changes.size())) {
+        h.messages.try_push(handoff_message{top, rx_ns, changes.size()});
+
+        // 与 drain_handoff 里清标志后的栅栏配对：要么这里看到标志已清、重新排一次，要么那边取到这条消息
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!h.drain_scheduled.exchange(true, std::memory_order_acq_rel)) {
+            // 回调状态从该 connector 的 handler_memory 分配，稳态下不走全局 new
+            boost::asio::post(strand_, recycle(connector->handler_mem(), [this, venue]() { drain_handoff(venue); }));
+        }
+        return;
+    }
+
+    // 环满（strand 落后太多）或前面还有退回的消息：按值 post，执行前先把环里更早的消息取完
+    handoff_overflows_.fetch_add(1, std::memory_order_relaxed);
+    h.fallback_inflight.fetch_add(1, std::memory_order_acq_rel);
+    boost::asio::post(strand_, recycle(connector->handler_mem(), [this, venue, changes, top, rx_ns]() {
+        drain_handoff(venue);
+        strand_queue_.fetch_sub(1, std::memory_order_relaxed);
+        update_bbo(venue, top);
+        update_consolidated_book(venue, changes, rx_ns);
+        handoff_[venue]->fallback_inflight.fetch_sub(1, std::memory_order_release);
+    }));
+}
+
+void Aggregator::drain_handoff(std::size_t venue) {
+    alloc_scope scope(alloc_stage::consolidate);
+    venue_handoff& h = *handoff_[venue];
+    h.drain_scheduled.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // 一次最多取一环的量，生产者一直在写时让其他交易所的回调也有机会执行
+    handoff_message msg;
+    for (std::size_t n = 0; n < HANDOFF_MESSAGES && h.messages.try_pop(msg); ++n) {
+        handoff_scratch_.clear();
+        h.changes.pop_into(handoff_scratch_, msg.changes);
+        strand_queue_.fetch_sub(1, std::memory_order_relaxed);
+        update_bbo(venue, msg.top);  // 先推最优价，再改深度
+        update_consolidated_book(venue, handoff_scratch_, msg.rx_ns);
+    }
+    if (!h.messages.empty() && !h.drain_scheduled.exchange(true, std::memory_order_acq_rel)) {
+        boost::asio::post(strand_, recycle(handler_mem_, [this, venue]() { drain_handoff(venue); }));
+    }
+}
+
+void Aggregator::on_trades(const std::vector<trade_print>& trades) {
+    // 多个 connector 线程会同时写：锁内只拷贝定长结构，proto 在推送线程里构建
+    {
+        std::lock_guard<std::mutex> lock(trades_mutex_);
+        for (const auto& t : trades) trade_ring_[++trade_seq_ % MAX_RECENT_TRADES] = t;
+    }
+    trades_cv_.notify_all();
+}
+
+void Aggregator::start_relay(relay_config cfg) {
+    std::cout << "[relay] Relay mode: serving " << cfg.upstream << " instead of connecting to exchanges" << std::endl;
+    relay_ = std::make_unique<relay_client>(std::move(cfg),
+        [this](aggregator::BookUpdate& update) { on_relay_book(update); },
+        [this](const aggregator::TradeBatch& batch) { on_relay_trades(batch); });
+
+    // 交易所列表取上游的，之后按名字映射（上游重启后顺序变了也能对上）
+    aggregator::BookUpdate first;
+    if (!relay_->fetch_book(first)) return;
+    for (const auto& name : first.venues()) {
+        if (venue_names_.size() < MAX_VENUES) venue_names_.push_back(name);
+    }
+    std::cout << "[relay] Upstream has " << venue_names_.size() << " venues, " << first.bids_size() << " bids / "
+              << first.asks_size() << " asks" << std::endl;
+
+    // io 线程尚未运行，直接应用第一份簿
+    apply_relay_book(first);
+    relay_->start();
+}
+
+void Aggregator::on_relay_book(aggregator::BookUpdate& update) {
+    // 每份都是整本簿：strand 跟不上时只需要最新的一份，中间的直接丢掉
+    {
+        std::lock_guard<std::mutex> lock(relay_mutex_);
+        relay_book_.Swap(&update);
+        if (relay_book_pending_) return;
+        relay_book_pending_ = true;
+    }
+    boost::asio::post(strand_, [this] {
+        aggregator::BookUpdate latest;
+        {
+            std::lock_guard<std::mutex> lock(relay_mutex_);
+            latest.Swap(&relay_book_);
+            relay_book_pending_ = false;
+        }
+        apply_relay_book(latest);
     });
 }
 
-void Aggregator::update_consolidated_book(market_connector* connector) {
-    // strand 保证这里是单线程执行，无需锁
-    consolidated_bids_.clear();
-    consolidated_asks_.clear();
+namespace {
+
+// 合并簿与上游簿同序（买价降序 / 卖价升序），归并一遍得到各交易所的档位变化
+template <class Book>
+void diff_relay_side(const Book& book, const google::protobuf::RepeatedPtrField<aggregator::Level>& levels,
+                     const std::array<int, MAX_VENUES>& id_map, std::size_t venue_count, book_side side,
+                     std::array<std::vector<level_change>, MAX_VENUES>& out) {
+    auto upstream_qty = [&](const aggregator::Level& l) {
+        std::array<double, MAX_VENUES> q{};
+        for (int j = 0; j < l.venue_quantities_size() && j < static_cast<int>(MAX_VENUES); ++j) {
+            if (id_map[j] >= 0) q[id_map[j]] = l.venue_quantities(j);
+        }
+        return q;
+    };
+
+    const auto cmp = book.key_comp();
+    auto it = book.begin();
+    int i = 0;
+    while (it != book.end() || i < levels.size()) {
+        if (i == levels.size() || (it != book.end() && cmp(it->first, levels[i].price()))) {
+            // 上游已经没有这个价位
+            for (std::size_t v = 0; v < venue_count; ++v) {
+                if (it->second.by_venue[v] > 0.0) out[v].push_back({side, it->first, 0.0});
+            }
+            ++it;
+        } else if (it == book.end() || cmp(levels[i].price(), it->first)) {
+            auto q = upstream_qty(levels[i]);
+            for (std::size_t v = 0; v < venue_count; ++v) {
+                if (q[v] > 0.0) out[v].push_back({side, levels[i].price(), q[v]});
+            }
+            ++i;
+        } else {
+            auto q = upstream_qty(levels[i]);
+            for (std::size_t v = 0; v < venue_count; ++v) {
+                if (q[v] != it->second.by_venue[v]) out[v].push_back({side, it->first, q[v]});
+            }
+            ++it;
+            ++i;
+        }
+    }
+}
+
+}  // namespace
+
+void Aggregator::apply_relay_book(const aggregator::BookUpdate& update) {
+    // 上游 venue 下标 -> 本地 venue id，不认识的交易所忽略
+    std::array<int, MAX_VENUES> id_map;
+    id_map.fill(-1);
+    for (int j = 0; j < update.venues_size() && j < static_cast<int>(MAX_VENUES); ++j) {
+        auto it = std::find(venue_names_.begin(), venue_names_.end(), update.venues(j));
+        if (it != venue_names_.end()) id_map[j] = static_cast<int>(it - venue_names_.begin());
+    }
+
+    const std::size_t venue_count = venue_names_.size();
+    for (auto& changes : relay_changes_) changes.clear();
+    diff_relay_side(consolidated_bids_, update.bids(), id_map, venue_count, book_side::bid, relay_changes_);
+    diff_relay_side(consolidated_asks_, update.asks(), id_map, venue_count, book_side::ask, relay_changes_);
+
+    // 与 connector 送来的变化走同一条路径：合并发布、信号、BBO、cross 检测都在本地算
+    // 上游的内核接收时间原样传下去，下游看到的是跨两级的处理延迟
+    for (std::size_t v = 0; v < venue_count; ++v) {
+        if (relay_changes_[v].empty()) continue;
+        update_consolidated_book(v, relay_changes_[v], update.rx_timestamp_ns());
+        update_bbo(v, venue_top(v));
+    }
+}
+
+top_of_book Aggregator::venue_top(std::size_t venue) const {
+    top_of_book top;
+    for (const auto& [price, lvl] : consolidated_bids_) {
+        if (lvl.by_venue[venue] > 0.0) {
+            top.bid_price = price;
+            top.bid_qty = lvl.by_venue[venue];
+            break;
+        }
+    }
+    for (const auto& [price, lvl] : consolidated_asks_) {
+        if (lvl.by_venue[venue] > 0.0) {
+            top.ask_price = price;
+            top.ask_qty = lvl.by_venue[venue];
+            break;
+        }
+    }
+    return top;
+}
+
+void Aggregator::on_relay_trades(const aggregator::TradeBatch& batch) {
+    relay_trades_.clear();
+    for (const auto& t : batch.trades()) {
+        auto it = std::find(venue_names_.begin(), venue_names_.end(), t.venue());
+        if (it == venue_names_.end()) continue;
+        trade_print p;
+        p.price = t.price();
+        p.qty = t.quantity();
+        p.exchange_ts_ms = t.exchange_ts_ms();
+        p.rx_ns = t.rx_timestamp_ns();
+        p.trade_id = t.trade_id();
+        p.venue = static_cast<uint32_t>(it - venue_names_.begin());
+        p.aggressor = t.aggressor() == aggregator::AGGRESSOR_SELL ? book_side::ask : book_side::bid;
+        relay_trades_.push_back(p);
+    }
+    if (!relay_trades_.empty()) on_trades(relay_trades_);
+}
+
+Aggregator::coalesce_stats Aggregator::coalescing() const {
+    coalesce_stats s;
+    s.updates = book_updates_.load(std::memory_order_relaxed);
+    s.versions = versions_published_.load(std::memory_order_relaxed);
+    s.coalesced = s.updates > s.versions ? s.updates - s.versions : 0;
+    s.max_burst = max_burst_.load(std::memory_order_relaxed);
+    return s;
+}
+
+namespace {
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// 推送线程上的 gRPC 写，序列化在 Write 里面做，一起记到 write 阶段
+template <class Writer, class Msg>
+bool profiled_write(Writer* writer, const Msg& msg) {
+    alloc_scope scope(alloc_stage::write);
+    return writer->Write(msg);
+}
+
+}  // namespace
+
+void Aggregator::update_bbo(std::size_t venue, const top_of_book& top) {
+    venue_bbo_[venue] = top;
+
+    const std::size_t venue_count = std::max(venue_names_.size(), venue + 1);
+    crosses_.on_venue_top(venue, venue_bbo_, venue_count, steady_ns(), cross_events_);
+    if (!cross_events_.empty()) publish_crosses();
 
-    for (const auto& c : connectors_) {
-        for (const auto& [price, qty] : c->get_bids()) {
-            consolidated_bids_[price] += qty;
+    // 最优价取各交易所最优价的极值，数量为报同一价的交易所之和
+    top_of_book best;
+    for (std::size_t v = 0; v < venue_count; ++v) {
+        const auto& b = venue_bbo_[v];
+        if (b.bid_qty > 0.0) {
+            if (best.bid_qty == 0.0 || b.bid_price > best.bid_price) {
+                best.bid_price = b.bid_price;
+                best.bid_qty = b.bid_qty;
+            } else if (b.bid_price == best.bid_price) {
+                best.bid_qty += b.bid_qty;
+            }
+        }
+        if (b.ask_qty > 0.0) {
+            if (best.ask_qty == 0.0 || b.ask_price < best.ask_price) {
+                best.ask_price = b.ask_price;
+                best.ask_qty = b.ask_qty;
+            } else if (b.ask_price == best.ask_price) {
+                best.ask_qty += b.ask_qty;
+            }
         }
-        for (const auto& [price, qty] : c->get_asks()) {
-            consolidated_asks_[price] += qty;
+    }
+    if (best == bbo_) return;  // 只动了深度，最优价没变
+    bbo_ = best;
+
+    {
+        std::lock_guard<std::mutex> lock(bbo_mutex_);
+        latest_bbo_.set_timestamp_ms(now_ms());
+        latest_bbo_.set_seq(latest_bbo_.seq() + 1);
+        latest_bbo_.set_bid_price(best.bid_price);
+        latest_bbo_.set_bid_qty(best.bid_qty);
+        latest_bbo_.set_ask_price(best.ask_price);
+        latest_bbo_.set_ask_qty(best.ask_qty);
+        latest_bbo_.clear_venues();
+        for (std::size_t v = 0; v < venue_count; ++v) {
+            auto* vb = latest_bbo_.add_venues();
+            if (v < venue_names_.size()) vb->set_venue(venue_names_[v]);
+            vb->set_bid_price(venue_bbo_[v].bid_price);
+            vb->set_bid_qty(venue_bbo_[v].bid_qty);
+            vb->set_ask_price(venue_bbo_[v].ask_price);
+            vb->set_ask_qty(venue_bbo_[v].ask_qty);
+        }
+        latest_bbo_.set_stale(any_venue_stale());
+    }
+    bbo_cv_.notify_all();
+}
+
+void Aggregator::publish_crosses() {
+    alloc_scope scope(alloc_stage::build);
+    auto venue_name = [this](std::size_t v) {
+        return v < venue_names_.size() ? venue_names_[v] : std::to_string(v);
+    };
+    {
+        std::lock_guard<std::mutex> lock(crosses_mutex_);
+        for (const auto& e : cross_events_) {
+            aggregator::CrossEvent evt;
+            evt.set_timestamp_ms(now_ms());
+            evt.set_seq(++cross_seq_);
+            evt.set_kind(e.kind == cross_kind::crossed  ? aggregator::CROSS_CROSSED
+                         : e.kind == cross_kind::locked ? aggregator::CROSS_LOCKED
+                                                        : aggregator::CROSS_END);
+            evt.set_bid_venue(venue_name(e.bid_venue));
+            evt.set_ask_venue(venue_name(e.ask_venue));
+            evt.set_bid_price(e.bid_price);
+            evt.set_ask_price(e.ask_price);
+            evt.set_size(e.size);
+            evt.set_duration_us(e.duration_ns / 1000);
+            recent_crosses_.push_back(std::move(evt));
+            if (recent_crosses_.size() > MAX_RECENT_CROSSES) recent_crosses_.pop_front();
         }
     }
+    cross_events_.clear();
+    crosses_cv_.notify_all();
+}
+
+void Aggregator::update_consolidated_book(std::size_t venue, const std::vector<level_change>& changes, int64_t rx_ns) {
+    // strand 保证这里是单线程执行，无需锁
+    alloc_scope scope(alloc_stage::consolidate);
+    const int64_t start_ns = steady_ns();
+    // 该交易所第一条实时数据：先清掉快照里遗留的分量，再应用实时变化
+    if (venue_stale_[venue]) drop_stale_venue(venue);
+    venue_update_ms_[venue] = now_ms();
+
+    for (const auto& c : changes) apply_level(venue, c);
+
+    const uint64_t apply_ns = static_cast<uint64_t>(steady_ns() - start_ns);
+    apply_ns_ += apply_ns;
+    max_apply_ns_ = std::max(max_apply_ns_, apply_ns);
+
+    if (rx_ns > 0) {
+        book_rx_ns_ = std::max(book_rx_ns_, rx_ns);
+        if (pending_rx_ns_ == 0 || rx_ns < pending_rx_ns_) pending_rx_ns_ = rx_ns;
+    }
+
+    // 合并发布：同一批排在 strand 里的更新只出一个版本
+    // 第一条更新把 publish_version 排到队尾，它之前已经排队的更新都会先应用进来
+    book_updates_.fetch_add(1, std::memory_order_relaxed);
+    ++pending_updates_;
+    if (!publish_pending_) {
+        publish_pending_ = true;
+        boost::asio::post(strand_, recycle(handler_mem_, [this]() { publish_version(); }));
+    }
+}
+
+void Aggregator::apply_level(std::size_t venue, const level_change& c) {
+    const double delta = c.side == book_side::bid ? apply_venue_level(consolidated_bids_, venue, c.price, c.qty)
+                                                  : apply_venue_level(consolidated_asks_, venue, c.price, c.qty);
+    signals_.on_level_changed(c.side, c.price);
+    if (history_) history_->add(venue, c);
+    if (depth_index_) depth_index_->on_level_changed(c.side, c.price, delta);
+}
+
+void Aggregator::publish_version() {
+    alloc_scope scope(alloc_stage::consolidate);
+    publish_pending_ = false;
+    if (pending_updates_ == 0) return;
+
+    if (pending_updates_ > max_burst_.load(std::memory_order_relaxed)) {
+        max_burst_.store(pending_updates_, std::memory_order_relaxed);
+    }
+    pending_updates_ = 0;
+    const int64_t start_ns = steady_ns();
 
     // latest_book_update_ = build_book_update();
-    version_.fetch_add(1, std::memory_order_release);
+    uint64_t version = version_.fetch_add(1, std::memory_order_release) + 1;
+
+    // 中间价移出索引窗口中部时重新居中：第一次有档位时在这里直接建，
+    // 之后在后台线程建，建好后的下一次发布换上
+    if (depth_index_) {
+        depth_index_->poll_rebuild();
+        double best_bid = consolidated_bids_.empty() ? 0.0 : consolidated_bids_.begin()->first;
+        double best_ask = consolidated_asks_.empty() ? 0.0 : consolidated_asks_.begin()->first;
+        if (depth_index_->off_center(best_bid, best_ask)) {
+            if (!depth_index_->built()) depth_index_->rebuild(consolidated_bids_, consolidated_asks_);
+            else depth_index_->begin_rebuild(consolidated_bids_, consolidated_asks_);
+        }
+    }
+
+    if (tick_store_ || history_) {
+        int64_t ts_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        if (tick_store_) tick_store_->append(ts_ns, version, consolidated_bids_, consolidated_asks_);
+        if (history_) history_->commit(ts_ns, version, consolidated_bids_, consolidated_asks_);
+    }
+
+    if (signals_.refresh(consolidated_bids_, consolidated_asks_)) {
+        publish_signals(version);
+    }
+    versions_published_.fetch_add(1, std::memory_order_relaxed);
+
+    version_published_ns_ = steady_ns();
+    version_wall_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const uint64_t publish_ns = static_cast<uint64_t>(version_published_ns_ - start_ns);
+    publish_ns_ += publish_ns;
+    max_publish_ns_ = std::max(max_publish_ns_, publish_ns);
+
+    // 本进程的处理延迟：这批里最早到达内核的消息到版本发布
+    if (pending_rx_ns_ > 0) {
+        int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        uint64_t rx_ns = static_cast<uint64_t>(std::max<int64_t>(0, now_ns - pending_rx_ns_));
+        rx_to_publish_ns_ += rx_ns;
+        max_rx_to_publish_ns_ = std::max(max_rx_to_publish_ns_, rx_ns);
+        pending_rx_ns_ = 0;
+    }
 
     // 可以在这里加日志或其他通知
     // std::cout << "[" << name_ << "] Book updated, version: " << version_.load() << std::endl;
 }
 
-aggregator::BookUpdate Aggregator::build_book_update() {
+void Aggregator::restore_snapshot() {
+    book_snapshot snap;
+    if (!load_book_snapshot(snapshot_cfg_.path, snap)) return;
+
+    // 快照里的 venue id 按名字映射到当前配置（交易所顺序可能变了，已删除的交易所忽略）
+    std::array<int, MAX_VENUES> id_map;
+    id_map.fill(-1);
+    for (std::size_t i = 0; i < snap.venues.size(); ++i) {
+        for (std::size_t v = 0; v < venue_names_.size(); ++v) {
+            if (venue_names_[v] == snap.venues[i].name) {
+                id_map[i] = static_cast<int>(v);
+                venue_stale_[v] = true;
+                venue_update_ms_[v] = snap.venues[i].last_update_ms;
+            }
+        }
+    }
+
+    auto restore_side = [&](auto& book, book_side side, const auto& levels) {
+        for (const auto& [price, lvl] : levels) {
+            for (std::size_t i = 0; i < snap.venues.size(); ++i) {
+                if (id_map[i] < 0 || lvl.by_venue[i] <= 0.0) continue;
+                apply_venue_level(book, static_cast<std::size_t>(id_map[i]), price, lvl.by_venue[i]);
+            }
+            signals_.on_level_changed(side, price);
+        }
+    };
+    restore_side(consolidated_bids_, book_side::bid, snap.bids);
+    restore_side(consolidated_asks_, book_side::ask, snap.asks);
+
+    uint64_t version = version_.fetch_add(1, std::memory_order_release) + 1;
+    snapshot_version_ = version;
+    signals_.refresh(consolidated_bids_, consolidated_asks_);
+    publish_signals(version);
+
+    std::cout << "[snapshot] Restored " << snap.bids.size() << " bids / " << snap.asks.size()
+              << " asks from " << snapshot_cfg_.path << " (age "
+              << (now_ms() - snap.timestamp_ms) << " ms), serving as stale until live data" << std::endl;
+}
+
+void Aggregator::drop_stale_venue(std::size_t venue) {
+    venue_stale_[venue] = false;
+
+    // 先收集价位再删，apply_venue_level 可能 erase 节点
+    std::vector<double> prices;
+    for (const auto& [price, lvl] : consolidated_bids_) {
+        if (lvl.by_venue[venue] > 0.0) prices.push_back(price);
+    }
+    for (double price : prices) apply_level(venue, {book_side::bid, price, 0.0});
+
+    prices.clear();
+    for (const auto& [price, lvl] : consolidated_asks_) {
+        if (lvl.by_venue[venue] > 0.0) prices.push_back(price);
+    }
+    for (double price : prices) apply_level(venue, {book_side::ask, price, 0.0});
+
+    std::cout << "[snapshot] " << venue_names_[venue] << " is live, dropped snapshot levels" << std::endl;
+}
+
+bool Aggregator::any_venue_stale() const {
+    for (std::size_t v = 0; v < venue_names_.size(); ++v) {
+        if (venue_stale_[v]) return true;
+    }
+    return false;
+}
+
+void Aggregator::schedule_snapshot() {
+    snapshot_timer_.expires_after(std::chrono::milliseconds(snapshot_cfg_.interval_ms));
+    snapshot_timer_.async_wait([this](boost::system::error_code ec) {
+        if (ec) return;
+        write_snapshot();
+        schedule_snapshot();
+    });
+}
+
+void Aggregator::write_snapshot() {
+    uint64_t version = version_.load(std::memory_order_acquire);
+    const bool retry = snapshot_failed_.exchange(false, std::memory_order_relaxed);
+    if (version == snapshot_version_ && !retry) return;  // 没有变化不重写
+
+    // strand 上只拷贝，落盘交给写线程
+    auto snap = std::make_unique<book_snapshot>();
+    snap->timestamp_ms = now_ms();
+    for (std::size_t v = 0; v < venue_names_.size(); ++v) {
+        snap->venues.push_back({venue_names_[v], venue_update_ms_[v]});
+    }
+    snap->bids.assign(consolidated_bids_.begin(), consolidated_bids_.end());
+    snap->asks.assign(consolidated_asks_.begin(), consolidated_asks_.end());
+
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex_);
+        snapshot_queued_ = std::move(snap);  // 写线程还没取走的旧快照直接替换
+        if (!snapshot_thread_.joinable()) snapshot_thread_ = std::thread([this] { run_snapshot_writer(); });
+    }
+    snapshot_cv_.notify_one();
+    snapshot_version_ = version;
+}
+
+void Aggregator::run_snapshot_writer() {
+    std::unique_lock<std::mutex> lock(snapshot_mutex_);
+    for (;;) {
+        snapshot_cv_.wait(lock, [this] { return snapshot_stop_ || snapshot_queued_; });
+        if (!snapshot_queued_) return;
+
+        std::unique_ptr<book_snapshot> snap = std::move(snapshot_queued_);
+        lock.unlock();
+        if (!save_book_snapshot(snapshot_cfg_.path, *snap)) {
+            snapshot_failed_.store(true, std::memory_order_relaxed);
+        }
+        lock.lock();
+    }
+}
+
+void Aggregator::publish_signals(uint64_t version) {
+    alloc_scope scope(alloc_stage::build);
+    const auto& v = signals_.values();
+    {
+        std::lock_guard<std::mutex> lock(signals_mutex_);
+        latest_signals_.set_timestamp_ms(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()
+            ).count()
+        );
+        latest_signals_.set_version(version);
+        latest_signals_.set_best_bid(v.best_bid);
+        latest_signals_.set_best_ask(v.best_ask);
+        latest_signals_.set_microprice(v.microprice);
+        latest_signals_.set_imbalance(v.imbalance);
+        latest_signals_.set_bid_vwap(v.bid_vwap);
+        latest_signals_.set_ask_vwap(v.ask_vwap);
+        latest_signals_.set_imbalance_levels(static_cast<uint32_t>(signals_.config().imbalance_levels));
+        latest_signals_.set_vwap_depth(signals_.config().vwap_depth);
+        latest_signals_.set_stale(any_venue_stale());
+    }
+    signals_cv_.notify_all();
+}
+
+aggregator::BookUpdate Aggregator::build_book_update(bool with_venues) {
+    alloc_scope scope(alloc_stage::build);
     aggregator::BookUpdate update;
-    update.set_timestamp_ms(
-        std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()
-        ).count()
-    );
+    // 时间戳取版本发布的时刻而不是这份拷贝构建的时刻，客户端算出的延迟包含推送线程的等待
+    // 还没发布过版本（刚从快照恢复）时用当前时间
+    const int64_t ts_ns = version_wall_ns_ > 0 ? version_wall_ns_
+                                               : std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                     std::chrono::system_clock::now().time_since_epoch()).count();
+    update.set_timestamp_ms(ts_ns / 1'000'000);
+    update.set_timestamp_ns(ts_ns);
+    update.set_rx_timestamp_ns(book_rx_ns_);
+    update.set_version(version_.load(std::memory_order_acquire));
+
+    const std::size_t venue_count = venue_names_.size();
+    for (std::size_t v = 0; v < venue_count; ++v) {
+        if (venue_stale_[v]) {
+            update.set_stale(true);
+            update.add_stale_venues(venue_names_[v]);
+        }
+    }
 
     // 限制深度，例如 50 档
     constexpr int MAX_DEPTH = 5000;
-    int count = 0;
-    for (const auto& [price, qty] : consolidated_bids_) {
-        if (count++ >= MAX_DEPTH) break;
-        auto* level = update.add_bids();
-        level->set_price(price);
-        level->set_quantity(qty);
+    add_book_levels(update, consolidated_bids_, consolidated_asks_, with_venues, MAX_DEPTH);
+    return update;
+}
+
+void Aggregator::add_book_levels(aggregator::BookUpdate& update, const consolidated_bid_book& bids,
+                                 const consolidated_ask_book& asks, bool with_venues, int depth) const {
+    const std::size_t venue_count = venue_names_.size();
+    if (with_venues) {
+        for (const auto& name : venue_names_) update.add_venues(name);
     }
 
-    count = 0;
-    for (const auto& [price, qty] : consolidated_asks_) {
-        if (count++ >= MAX_DEPTH) break;
-        auto* level = update.add_asks();
+    auto fill_level = [&](aggregator::Level* level, double price, const venue_level& lvl) {
         level->set_price(price);
-        level->set_quantity(qty);
+        level->set_quantity(lvl.total);
+        if (with_venues) {
+            for (std::size_t v = 0; v < venue_count; ++v) level->add_venue_quantities(lvl.by_venue[v]);
+        }
+    };
+
+    int count = 0;
+    for (const auto& [price, lvl] : bids) {
+        if (count++ >= depth) break;
+        fill_level(update.add_bids(), price, lvl);
     }
 
-    return update;
+    count = 0;
+    for (const auto& [price, lvl] : asks) {
+        if (count++ >= depth) break;
+        fill_level(update.add_asks(), price, lvl);
+    }
 }
 
 void Aggregator::start_grpc_server() {
-    std::string server_address("0.0.0.0:50051");
+    const int port = runtime_.grpc_port;
+    std::string server_address = "0.0.0.0:" + std::to_string(port);
 
     // 检查端口是否被占用（可选，但有用）
     int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -144,11 +784,11 @@ void Aggregator::start_grpc_server() {
     sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(50051);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
     addr.sin_addr.s_addr = INADDR_ANY;
 
     if (bind(sock, (sockaddr*)&addr, sizeof(addr)) == -1) {
-        std::cerr << "Port 50051 already in use! Exiting." << std::endl;
+        std::cerr << "Port " << port << " already in use! Exiting." << std::endl;
         std::cerr << "Error: " << strerror(errno) << " (code: " << errno << ")" << std::endl;
         close(sock);
         exit(1);
@@ -166,39 +806,471 @@ void Aggregator::start_grpc_server() {
     grpc_server_->Wait();
 }
 
+// 推送线程绑核：gRPC 同步 server 的线程会被复用，调用方用 scoped_thread_affinity 在 RPC 结束时恢复
+void Aggregator::pin_publisher_thread() {
+    if (runtime_.publisher_cores.empty()) return;
+    unsigned idx = next_publisher_core_.fetch_add(1, std::memory_order_relaxed);
+    int core = runtime_.publisher_cores[idx % runtime_.publisher_cores.size()];
+    pin_current_thread({core}, "publisher");
+}
+
 grpc::Status Aggregator::SubscribeBook(grpc::ServerContext* context,
                                        const aggregator::SubscribeRequest* request,
                                        grpc::ServerWriter<aggregator::BookUpdate>* writer) {
     
     uint64_t last_seen_version = 0;
+    scoped_thread_affinity affinity;  // 退出时恢复，线程还给 gRPC 线程池时不带绑核
+    pin_publisher_thread();
+    auto sub = add_subscriber("SubscribeBook", context);
 
     while (!context->IsCancelled()) {
         // 使用 promise / future 等待 strand 执行并获取最新消息
-        std::promise<std::pair<aggregator::BookUpdate, uint64_t>> prom;
+        std::promise<std::tuple<aggregator::BookUpdate, uint64_t, int64_t>> prom;
         auto fut = prom.get_future();
 
-        boost::asio::post(strand_, [&prom, this]() {
-            aggregator::BookUpdate update = build_book_update();
+        boost::asio::post(strand_, [&prom, this, with_venues = request->with_venues()]() {
+            aggregator::BookUpdate update = build_book_update(with_venues);
             uint64_t ver = version_.load(std::memory_order_acquire);
-            prom.set_value({update, ver});
+            prom.set_value({update, ver, version_published_ns_});
         });
 
-        auto [update, current_version] = fut.get();  // 阻塞等待完成
+        auto [update, current_version, published_ns] = fut.get();  // 阻塞等待完成
 
         if (current_version > last_seen_version) {
+            if (last_seen_version > 0) {
+                sub->skipped.fetch_add(current_version - last_seen_version - 1, std::memory_order_relaxed);
+            }
             last_seen_version = current_version;
 
             // protobuf 序列化前确保状态一致（通常不需要，但保险）
             update.mutable_bids()->Reserve(update.bids_size());
             update.mutable_asks()->Reserve(update.asks_size());
 
-            if (!writer->Write(update)) {
+            if (!profiled_write(writer, update)) {
                 break;
             }
+
+            // 延迟 = 版本发布到这条写完
+            int64_t lag_us = (steady_ns() - published_ns) / 1000;
+            sub->messages.fetch_add(1, std::memory_order_relaxed);
+            sub->last_lag_us.store(lag_us, std::memory_order_relaxed);
+            if (lag_us > sub->max_lag_us.load(std::memory_order_relaxed)) {
+                sub->max_lag_us.store(lag_us, std::memory_order_relaxed);
+            }
         } else {
             std::this_thread::sleep_for(std::chrono::milliseconds(20));
         }
     }
 
+    remove_subscriber(sub);
+    return grpc::Status::OK;
+}
+
+grpc::Status Aggregator::SubscribeSignals(grpc::ServerContext* context,
+                                          const aggregator::SubscribeRequest* /*request*/,
+                                          grpc::ServerWriter<aggregator::Signals>* writer) {
+    uint64_t last_seen_version = 0;
+    scoped_thread_affinity affinity;  // 退出时恢复，线程还给 gRPC 线程池时不带绑核
+    pin_publisher_thread();
+    auto sub = add_subscriber("SubscribeSignals", context);
+
+    while (!context->IsCancelled()) {
+        aggregator::Signals signals;
+        {
+            // 信号很小，直接在锁内拷贝；超时醒来只为检查 IsCancelled
+            std::unique_lock<std::mutex> lock(signals_mutex_);
+            if (!signals_cv_.wait_for(lock, std::chrono::milliseconds(100), [&] {
+                    return latest_signals_.version() > last_seen_version;
+                })) {
+                continue;
+            }
+            signals = latest_signals_;
+        }
+
+        // 信号不是每个版本都变，版本号的跳跃不算丢失
+        last_seen_version = signals.version();
+        if (!profiled_write(writer, signals)) {
+            break;
+        }
+        sub->messages.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    remove_subscriber(sub);
+    return grpc::Status::OK;
+}
+
+grpc::Status Aggregator::SubscribeBBO(grpc::ServerContext* context,
+                                      const aggregator::SubscribeRequest* /*request*/,
+                                      grpc::ServerWriter<aggregator::BBO>* writer) {
+    uint64_t last_seen_seq = 0;
+    scoped_thread_affinity affinity;  // 退出时恢复，线程还给 gRPC 线程池时不带绑核
+    pin_publisher_thread();
+    auto sub = add_subscriber("SubscribeBBO", context);
+
+    while (!context->IsCancelled()) {
+        aggregator::BBO bbo;
+        {
+            // 与 SubscribeSignals 相同：最优价变化时唤醒，超时只为检查 IsCancelled
+            std::unique_lock<std::mutex> lock(bbo_mutex_);
+            if (!bbo_cv_.wait_for(lock, std::chrono::milliseconds(100), [&] {
+                    return latest_bbo_.seq() > last_seen_seq;
+                })) {
+                continue;
+            }
+            bbo = latest_bbo_;
+        }
+
+        if (last_seen_seq > 0) {
+            sub->skipped.fetch_add(bbo.seq() - last_seen_seq - 1, std::memory_order_relaxed);
+        }
+        last_seen_seq = bbo.seq();
+        if (!profiled_write(writer, bbo)) {
+            break;
+        }
+        sub->messages.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    remove_subscriber(sub);
+    return grpc::Status::OK;
+}
+
+grpc::Status Aggregator::SubscribeCrosses(grpc::ServerContext* context,
+                                          const aggregator::SubscribeRequest* /*request*/,
+                                          grpc::ServerWriter<aggregator::CrossEvent>* writer) {
+    scoped_thread_affinity affinity;  // 退出时恢复，线程还给 gRPC 线程池时不带绑核
+    pin_publisher_thread();
+    auto sub = add_subscriber("SubscribeCrosses", context);
+
+    // 只推订阅之后发生的事件
+    uint64_t last_seen_seq;
+    {
+        std::lock_guard<std::mutex> lock(crosses_mutex_);
+        last_seen_seq = cross_seq_;
+    }
+
+    std::vector<aggregator::CrossEvent> batch;
+    while (!context->IsCancelled()) {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(crosses_mutex_);
+            if (!crosses_cv_.wait_for(lock, std::chrono::milliseconds(100), [&] {
+                    return cross_seq_ > last_seen_seq;
+                })) {
+                continue;
+            }
+            // 落后太多时队列里更早的事件已经丢弃，从还在的最早一条开始
+            for (const auto& evt : recent_crosses_) {
+                if (evt.seq() > last_seen_seq) batch.push_back(evt);
+            }
+            sub->skipped.fetch_add(cross_seq_ - last_seen_seq - batch.size(), std::memory_order_relaxed);
+            last_seen_seq = cross_seq_;
+        }
+
+        bool ok = true;
+        for (const auto& evt : batch) {
+            if (!profiled_write(writer, evt)) {
+                ok = false;
+                break;
+            }
+            sub->messages.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!ok) break;
+    }
+
+    remove_subscriber(sub);
+    return grpc::Status::OK;
+}
+
+grpc::Status Aggregator::SubscribeTrades(grpc::ServerContext* context,
+                                         const aggregator::SubscribeRequest* /*request*/,
+                                         grpc::ServerWriter<aggregator::TradeBatch>* writer) {
+    scoped_thread_affinity affinity;  // 退出时恢复，线程还给 gRPC 线程池时不带绑核
+    pin_publisher_thread();
+    auto sub = add_subscriber("SubscribeTrades", context);
+
+    // 只推订阅之后的成交
+    uint64_t last_seen_seq;
+    {
+        std::lock_guard<std::mutex> lock(trades_mutex_);
+        last_seen_seq = trade_seq_;
+    }
+
+    std::vector<trade_print> batch;
+    batch.reserve(MAX_RECENT_TRADES);
+    aggregator::TradeBatch msg;
+    while (!context->IsCancelled()) {
+        batch.clear();
+        uint64_t first_seq;
+        {
+            std::unique_lock<std::mutex> lock(trades_mutex_);
+            if (!trades_cv_.wait_for(lock, std::chrono::milliseconds(100), [&] {
+                    return trade_seq_ > last_seen_seq;
+                })) {
+                continue;
+            }
+            // 写得比推得快时环里更早的成交已被覆盖，从还在的最早一条开始
+            first_seq = std::max(last_seen_seq + 1,
+                                 trade_seq_ >= MAX_RECENT_TRADES ? trade_seq_ - MAX_RECENT_TRADES + 1 : 1);
+            for (uint64_t s = first_seq; s <= trade_seq_; ++s) batch.push_back(trade_ring_[s % MAX_RECENT_TRADES]);
+            sub->skipped.fetch_add(first_seq - last_seen_seq - 1, std::memory_order_relaxed);
+            last_seen_seq = trade_seq_;
+        }
+
+        // 一次唤醒攒下的成交合成一条消息发出
+        alloc_scope scope(alloc_stage::build);
+        msg.Clear();
+        msg.set_timestamp_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            const trade_print& t = batch[i];
+            auto* out = msg.add_trades();
+            out->set_seq(first_seq + i);
+            if (t.venue < venue_names_.size()) out->set_venue(venue_names_[t.venue]);
+            out->set_price(t.price);
+            out->set_quantity(t.qty);
+            out->set_aggressor(t.aggressor == book_side::bid ? aggregator::AGGRESSOR_BUY : aggregator::AGGRESSOR_SELL);
+            out->set_trade_id(t.trade_id);
+            out->set_exchange_ts_ms(t.exchange_ts_ms);
+            out->set_rx_timestamp_ns(t.rx_ns);
+        }
+        if (!profiled_write(writer, msg)) break;
+        sub->messages.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    remove_subscriber(sub);
+    return grpc::Status::OK;
+}
+
+std::shared_ptr<Aggregator::subscriber_entry> Aggregator::add_subscriber(const char* rpc,
+                                                                      grpc::ServerContext* context) {
+    auto sub = std::make_shared<subscriber_entry>();
+    sub->rpc = rpc;
+    if (context) sub->peer = context->peer();
+    sub->connected_ms = now_ms();
+
+    std::lock_guard<std::mutex> lock(subscribers_mutex_);
+    sub->id = ++next_subscriber_id_;
+    subscribers_.push_back(sub);
+    return sub;
+}
+
+void Aggregator::remove_subscriber(const std::shared_ptr<subscriber_entry>& sub) {
+    std::lock_guard<std::mutex> lock(subscribers_mutex_);
+    subscribers_.erase(std::remove(subscribers_.begin(), subscribers_.end(), sub), subscribers_.end());
+}
+
+void Aggregator::collect_stats(aggregator::Stats& out) {
+    constexpr auto STRAND_TIMEOUT = std::chrono::seconds(1);
+    out.set_timestamp_ms(now_ms());
+
+    // 各连接器的计数只在它自己的 strand 上写：把读取 post 过去，不给热路径加原子操作
+    // 先把所有读取都 post 出去再一起等，卡住的 strand 最多让 GetStats 等一个超时
+    // promise 用 shared_ptr 持有：超时返回后 strand 上的回调仍可能执行
+    // 多线路时去重计数在主线路的 arbiter 里，随主线路一起读回来，下标 = 线路号
+    using connector_read = std::pair<aggregator::ConnectorStats, std::vector<line_stats>>;
+    std::vector<std::future<connector_read>> reads;
+    auto read_connector = [&](const std::shared_ptr<market_connector>& c) {
+        auto prom = std::make_shared<std::promise<connector_read>>();
+        reads.push_back(prom->get_future());
+        boost::asio::post(c->strand(), [c, prom] {
+            const feed_stats& s = c->stats();
+            aggregator::ConnectorStats cs;
+            cs.set_venue(c->name());
+            cs.set_line(static_cast<uint32_t>(c->line()));
+            cs.set_messages(s.messages);
+            cs.set_parse_errors(s.parse_errors);
+            cs.set_reconnects(s.reconnects);
+            cs.set_tls_resumed(s.tls_resumed);
+            cs.set_last_gap_ms(s.last_gap_ms);
+            cs.set_max_gap_ms(s.max_gap_ms);
+            cs.set_wire_bytes(s.wire_bytes);
+            cs.set_payload_bytes(s.payload_bytes);
+            cs.set_read_cpu_ns(s.read_cpu_ns);
+            cs.set_read_cpu_samples(s.read_cpu_samples);
+            cs.set_parse_cpu_ns(s.parse_cpu_ns);
+            cs.set_rx_delay_ns(s.rx_delay_ns);
+            cs.set_max_rx_delay_ns(s.max_rx_delay_ns);
+            std::vector<line_stats> lines;
+            const line_arbiter& arb = c->arbiter();
+            for (std::size_t i = 0; arb.lines() > 1 && i < arb.lines(); ++i) lines.push_back(arb.stats(i));
+            prom->set_value({std::move(cs), std::move(lines)});
+        });
+    };
+    for (const auto& c : connectors_) read_connector(c);
+    for (const auto& c : backup_lines_) read_connector(c);
+
+    auto prom = std::make_shared<std::promise<aggregator::AggregatorStats>>();
+    auto fut = prom->get_future();
+    boost::asio::post(strand_, [this, prom] {
+        const coalesce_stats cs = coalescing();
+        aggregator::AggregatorStats as;
+        as.set_version(version_.load(std::memory_order_acquire));
+        as.set_updates(cs.updates);
+        as.set_versions(cs.versions);
+        as.set_coalesced(cs.coalesced);
+        as.set_max_burst(cs.max_burst);
+        as.set_strand_queue(strand_queue_.load(std::memory_order_relaxed));
+        as.set_max_strand_queue(max_strand_queue_.load(std::memory_order_relaxed));
+        as.set_apply_ns(apply_ns_);
+        as.set_max_apply_ns(max_apply_ns_);
+        as.set_publish_ns(publish_ns_);
+        as.set_max_publish_ns(max_publish_ns_);
+        as.set_rx_to_publish_ns(rx_to_publish_ns_);
+        as.set_max_rx_to_publish_ns(max_rx_to_publish_ns_);
+        {
+            std::lock_guard<std::mutex> lock(trades_mutex_);
+            as.set_trades(trade_seq_);
+        }
+        if (history_) {
+            const book_history::usage hu = history_->stats();
+            as.set_history_versions(hu.versions);
+            as.set_history_deltas(hu.deltas);
+            as.set_history_bytes(hu.bytes);
+            as.set_history_from_ms(hu.from_ns / 1'000'000);
+        }
+        if (depth_index_) as.set_depth_index_rebuilds(depth_index_->rebuilds());
+        as.set_handoff_overflows(handoff_overflows_.load(std::memory_order_relaxed));
+        as.set_bid_levels(consolidated_bids_.size());
+        as.set_ask_levels(consolidated_asks_.size());
+        prom->set_value(std::move(as));
+    });
+
+    const auto deadline = std::chrono::steady_clock::now() + STRAND_TIMEOUT;
+    std::map<std::string, std::vector<line_stats>> venue_lines;
+    for (auto& r : reads) {
+        if (r.wait_until(deadline) != std::future_status::ready) {
+            std::cerr << "[stats] a connector strand did not respond" << std::endl;
+            continue;
+        }
+        auto [cs, lines] = r.get();
+        if (!lines.empty()) venue_lines[cs.venue()] = std::move(lines);
+        *out.add_connectors() = std::move(cs);
+    }
+    for (auto& cs : *out.mutable_connectors()) {
+        auto it = venue_lines.find(cs.venue());
+        if (it == venue_lines.end() || cs.line() >= it->second.size()) continue;
+        cs.set_line_wins(it->second[cs.line()].wins);
+        cs.set_line_duplicates(it->second[cs.line()].duplicates);
+    }
+
+    if (fut.wait_until(deadline) == std::future_status::ready) {
+        *out.mutable_aggregator() = fut.get();
+    } else {
+        std::cerr << "[stats] aggregator strand did not respond" << std::endl;
+    }
+
+    if (alloc_profile_enabled) {
+        const alloc_profile profile = alloc_profile_snapshot();
+        for (std::size_t i = 0; i < profile.size(); ++i) {
+            auto* st = out.add_alloc_stages();
+            st->set_stage(alloc_stage_name(static_cast<alloc_stage>(i)));
+            st->set_allocations(profile[i].allocations);
+            st->set_bytes(profile[i].bytes);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(subscribers_mutex_);
+    for (const auto& sub : subscribers_) {
+        auto* ss = out.add_subscribers();
+        ss->set_id(sub->id);
+        ss->set_rpc(sub->rpc);
+        ss->set_peer(sub->peer);
+        ss->set_connected_ms(sub->connected_ms);
+        ss->set_messages(sub->messages.load(std::memory_order_relaxed));
+        ss->set_skipped(sub->skipped.load(std::memory_order_relaxed));
+        ss->set_last_lag_us(sub->last_lag_us.load(std::memory_order_relaxed));
+        ss->set_max_lag_us(sub->max_lag_us.load(std::memory_order_relaxed));
+    }
+}
+
+grpc::Status Aggregator::GetBookAt(grpc::ServerContext* /*context*/,
+                                   const aggregator::BookAtRequest* request,
+                                   aggregator::BookUpdate* response) {
+    if (!history_) {
+        return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION,
+                            "history is not enabled, set \"history\": {\"seconds\": N} in the config");
+    }
+
+    // 重建用本次调用自己的池，不碰 strand 上的合并簿；
+    // 不用 book_memory，免得开了大页时每次调用都从预留池里 mmap 一块 2MB
+    std::pmr::unsynchronized_pool_resource mem;
+    consolidated_bid_book bids(&mem);
+    consolidated_ask_book asks(&mem);
+    const int64_t at_ns = request->timestamp_ns() > 0 ? request->timestamp_ns() : INT64_MAX;
+    uint64_t version = 0;
+    int64_t version_ts_ns = 0;
+    if (!history_->book_at(at_ns, bids, asks, version, version_ts_ns)) {
+        return grpc::Status(grpc::StatusCode::OUT_OF_RANGE,
+                            "no history at " + std::to_string(at_ns) + ", earliest is " +
+                                std::to_string(history_->stats().from_ns));
+    }
+
+    constexpr int MAX_DEPTH = 5000;
+    const int depth = request->depth() > 0 ? static_cast<int>(std::min<uint32_t>(request->depth(), MAX_DEPTH)) : MAX_DEPTH;
+    response->set_timestamp_ms(version_ts_ns / 1'000'000);
+    response->set_timestamp_ns(version_ts_ns);
+    response->set_version(version);
+    add_book_levels(*response, bids, asks, request->with_venues(), depth);
     return grpc::Status::OK;
 }
+
+grpc::Status Aggregator::QueryDepth(grpc::ServerContext* /*context*/,
+                                    const aggregator::DepthQuery* request,
+                                    aggregator::DepthResult* response) {
+    if (!depth_index_) {
+        return grpc::Status(grpc::StatusCode::FAILED_PRECONDITION,
+                            "depth index is not enabled, set \"depth_index\": {\"tick\": ...} in the config");
+    }
+
+    // 索引只在 strand 上访问：整批查询 post 过去，每项 O(log n)
+    std::promise<void> prom;
+    auto fut = prom.get_future();
+    boost::asio::post(strand_, [&prom, this, request, response]() {
+        depth_index_->poll_rebuild();   // 后台重建好了就先换上
+        response->set_timestamp_ms(now_ms());
+        response->set_version(version_.load(std::memory_order_acquire));
+        for (const auto& q : request->items()) {
+            const book_side side = q.side() == aggregator::SIDE_ASK ? book_side::ask : book_side::bid;
+            depth_point p;
+            switch (q.target_case()) {
+                case aggregator::DepthQueryItem::kToPrice:  p = depth_index_->to_price(side, q.to_price()); break;
+                case aggregator::DepthQueryItem::kQuantity: p = depth_index_->to_quantity(side, q.quantity()); break;
+                case aggregator::DepthQueryItem::kNotional: p = depth_index_->to_notional(side, q.notional()); break;
+                default: break;
+            }
+            // 越过窗口远端且簿确实还有更深的档位时，结果不完整
+            double far_price = 0.0;
+            if (side == book_side::bid && !consolidated_bids_.empty()) far_price = consolidated_bids_.rbegin()->first;
+            if (side == book_side::ask && !consolidated_asks_.empty()) far_price = consolidated_asks_.rbegin()->first;
+
+            auto* r = response->add_items();
+            r->set_price(p.price);
+            r->set_cumulative_quantity(p.quantity);
+            r->set_cumulative_notional(p.notional);
+            r->set_reached(p.reached);
+            r->set_truncated(p.past_window && far_price > 0.0 && !depth_index_->covers(far_price));
+        }
+        prom.set_value();
+    });
+    fut.get();
+    return grpc::Status::OK;
+}
+
+grpc::Status Aggregator::GetStats(grpc::ServerContext* /*context*/,
+                                  const aggregator::StatsRequest* /*request*/,
+                                  aggregator::Stats* response) {
+    collect_stats(*response);
+    return grpc::Status::OK;
+}
+
+void Aggregator::run_stats_dump() {
+    std::unique_lock<std::mutex> lock(stats_stop_mutex_);
+    while (!stats_stop_cv_.wait_for(lock, std::chrono::milliseconds(runtime_.stats_interval_ms),
+                                    [this] { return stats_stop_; })) {
+        lock.unlock();
+        aggregator::Stats stats;
+        collect_stats(stats);
+        std::cout << "[stats] " << stats.ShortDebugString() << std::endl;
+        lock.lock();
+    }
+}
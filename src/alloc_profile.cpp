@@ -0,0 +1,54 @@
+#include "alloc_profile.h"
+#include <atomic>
+
+namespace {
+
+constexpr std::size_t STAGES = static_cast<std::size_t>(alloc_stage::count);
+
+// 每个阶段一条缓存行，多个线程同时分配时不互相争抢
+struct alignas(64) stage_counter {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+stage_counter g_counters[STAGES];
+
+}  // namespace
+
+const char* alloc_stage_name(alloc_stage stage) {
+    switch (stage) {
+        case alloc_stage::other: return "other";
+        case alloc_stage::read: return "read";
+        case alloc_stage::parse: return "parse";
+        case alloc_stage::consolidate: return "consolidate";
+        case alloc_stage::build: return "build";
+        case alloc_stage::write: return "write";
+        default: return "?";
+    }
+}
+
+#ifdef AGGREGATOR_ALLOC_PROFILE
+thread_local alloc_stage g_alloc_stage = alloc_stage::other;
+
+void alloc_profile_record(std::size_t bytes) {
+    stage_counter& c = g_counters[static_cast<std::size_t>(g_alloc_stage)];
+    c.allocations.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+#endif
+
+alloc_profile alloc_profile_snapshot() {
+    alloc_profile out;
+    for (std::size_t i = 0; i < STAGES; ++i) {
+        out[i].allocations = g_counters[i].allocations.load(std::memory_order_relaxed);
+        out[i].bytes = g_counters[i].bytes.load(std::memory_order_relaxed);
+    }
+    return out;
+}
+
+void alloc_profile_reset() {
+    for (auto& c : g_counters) {
+        c.allocations.store(0, std::memory_order_relaxed);
+        c.bytes.store(0, std::memory_order_relaxed);
+    }
+}
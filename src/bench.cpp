@@ -0,0 +1,522 @@
+// 微基准：./bench [suite...]，不带参数时跑全部
+// 报告每个场景的耗时和全局 operator new 调用次数
+// 每个场景结束时另打印整个场景（含场景里的线程）的分配次数和字节数
+#include "order_book.h"
+#include "depth_index.h"
+#include "runtime_config.h"
+#include <boost/asio.hpp>
+#include <boost/beast/zlib.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ===== 全局分配计数 =====
+// noinline：避免 GCC 内联后把 malloc/free 与 new/delete 误判为不匹配
+static std::atomic<std::size_t> g_alloc_count{0};
+static std::atomic<std::size_t> g_alloc_bytes{0};
+
+__attribute__((noinline)) void* operator new(std::size_t n) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(n, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+struct measurement {
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+template <class F>
+measurement measure(std::size_t ops, F&& body) {
+    std::size_t allocs_before = g_alloc_count.load(std::memory_order_relaxed);
+    auto t0 = bench_clock::now();
+    body();
+    auto t1 = bench_clock::now();
+    std::size_t allocs = g_alloc_count.load(std::memory_order_relaxed) - allocs_before;
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    return {ns / ops, static_cast<double>(allocs) / ops};
+}
+
+void report(const char* name, const measurement& m) {
+    std::printf("  %-34s %10.1f ns/op %10.3f allocs/op\n", name, m.ns_per_op, m.allocs_per_op);
+}
+
+// 模拟增量推送：在 mid 附近 200 个 tick 内随机 set / erase
+struct level_op {
+    double price;
+    double qty;
+};
+
+std::vector<level_op> make_level_ops(std::size_t n) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> tick(0, 199);
+    std::uniform_real_distribution<> qty(0.001, 5.0);
+    std::bernoulli_distribution erase(0.3);
+    std::vector<level_op> ops;
+    ops.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        ops.push_back({70000.0 - tick(gen) * 0.01, erase(gen) ? 0.0 : qty(gen)});
+    }
+    return ops;
+}
+
+template <class Book>
+void apply_ops(Book& book, const std::vector<level_op>& ops) {
+    for (const auto& op : ops) {
+        if (op.qty == 0.0) book.erase(op.price);
+        else book[op.price] = op.qty;
+    }
+}
+
+// ----- 单本订单簿的 insert / erase -----
+void bench_book_updates() {
+    constexpr std::size_t N = 1'000'000;
+    auto ops = make_level_ops(N);
+    std::printf("[book_updates] %zu level set/erase on one bid book\n", N);
+
+    {
+        std::map<double, double, std::greater<double>> book;
+        report("std::map (global heap)", measure(N, [&] { apply_ops(book, ops); }));
+    }
+    {
+        book_memory mem;
+        bid_book book(mem.resource());
+        report("pmr::map (book_memory pool)", measure(N, [&] { apply_ops(book, ops); }));
+    }
+}
+
+// ----- update_consolidated_book 的 clear + 重建 -----
+template <class Book, class Venues>
+void rebuild(Book& consolidated, const Venues& venues, std::size_t rounds) {
+    for (std::size_t r = 0; r < rounds; ++r) {
+        consolidated.clear();
+        for (const auto& v : venues) {
+            for (const auto& [price, qty] : v) consolidated[price] += qty;
+        }
+    }
+}
+
+void bench_consolidation() {
+    constexpr std::size_t ROUNDS = 20'000;
+    constexpr int VENUES = 3;
+    constexpr int DEPTH = 50;
+    std::printf("[consolidation] %zu rebuilds of %d venues x %d levels\n", ROUNDS, VENUES, DEPTH);
+
+    std::vector<std::map<double, double, std::greater<double>>> venues(VENUES);
+    for (int v = 0; v < VENUES; ++v) {
+        for (int i = 0; i < DEPTH; ++i) venues[v][70000.0 - (i * VENUES + v) * 0.01] = 1.0 + i;
+    }
+
+    {
+        std::map<double, double, std::greater<double>> consolidated;
+        report("std::map (global heap)", measure(ROUNDS, [&] { rebuild(consolidated, venues, ROUNDS); }));
+    }
+    {
+        book_memory mem;
+        bid_book consolidated(mem.resource());
+        report("pmr::map (book_memory pool)", measure(ROUNDS, [&] { rebuild(consolidated, venues, ROUNDS); }));
+    }
+}
+
+// ----- io 线程唤醒延迟：阻塞 run() vs 自旋 poll() -----
+// 本地 mock 行情：另一线程经 loopback TCP 按固定间隔推送 256 字节帧，
+// 帧头 8 字节是发送时刻 (steady_clock ns)，接收端在 async_read 回调里算延迟
+// 可选环境变量 BENCH_IO_CORE / BENCH_FEED_CORE 把两端绑到指定核
+constexpr std::size_t FEED_FRAME = 256;
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        bench_clock::now().time_since_epoch()).count();
+}
+
+std::vector<int> core_from_env(const char* var) {
+    const char* v = std::getenv(var);
+    if (!v) return {};
+    return {std::atoi(v)};
+}
+
+void run_mock_feed(unsigned short port, std::size_t count, std::chrono::microseconds interval) {
+    namespace net = boost::asio;
+    pin_current_thread(core_from_env("BENCH_FEED_CORE"), "mock feed");
+
+    net::io_context ioc;
+    net::ip::tcp::socket sock(ioc);
+    sock.connect({net::ip::address_v4::loopback(), port});
+    sock.set_option(net::ip::tcp::no_delay(true));
+
+    std::array<char, FEED_FRAME> frame{};
+    auto next = bench_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+        if (interval.count() > 0) {   // 0 = 背靠背连续发送（吞吐测试）
+            next += interval;
+            std::this_thread::sleep_until(next);
+        }
+        int64_t ts = now_ns();
+        std::memcpy(frame.data(), &ts, sizeof(ts));
+        net::write(sock, net::buffer(frame));
+    }
+}
+
+void print_latency(const char* name, std::vector<int64_t>& lat) {
+    if (lat.empty()) return;
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&](double p) { return lat[std::min(lat.size() - 1, static_cast<std::size_t>(p * lat.size()))] / 1000.0; };
+    std::printf("  %-34s p50 %8.2f us  p99 %8.2f us  p99.9 %8.2f us  max %8.2f us\n",
+                name, pct(0.50), pct(0.99), pct(0.999), lat.back() / 1000.0);
+}
+
+std::vector<int64_t> measure_feed_latency(bool busy_poll, std::size_t count,
+                                          std::chrono::microseconds interval = std::chrono::microseconds(100)) {
+    namespace net = boost::asio;
+    using tcp = net::ip::tcp;
+
+    net::io_context ioc;
+    tcp::acceptor acceptor(ioc, {net::ip::address_v4::loopback(), 0});
+    unsigned short port = acceptor.local_endpoint().port();
+
+    std::thread feed(run_mock_feed, port, count, interval);
+    tcp::socket sock = acceptor.accept();
+
+    std::vector<int64_t> lat;
+    lat.reserve(count);
+    std::array<char, FEED_FRAME> buf{};
+
+    std::function<void()> read_next = [&] {
+        net::async_read(sock, net::buffer(buf), [&](boost::system::error_code ec, std::size_t) {
+            if (ec) { ioc.stop(); return; }
+            int64_t ts;
+            std::memcpy(&ts, buf.data(), sizeof(ts));
+            lat.push_back(now_ns() - ts);
+            if (lat.size() == count) { ioc.stop(); return; }
+            read_next();
+        });
+    };
+    read_next();
+
+    run_io_loop(ioc, busy_poll);
+    feed.join();
+    return lat;
+}
+
+void bench_wakeup() {
+    constexpr std::size_t COUNT = 20'000;
+    std::printf("[wakeup] %zu frames @ 100us over loopback mock feed, send -> handler latency\n", COUNT);
+    pin_current_thread(core_from_env("BENCH_IO_CORE"), "io");
+
+    auto blocking = measure_feed_latency(false, COUNT);
+    print_latency("ioc.run() (epoll wait)", blocking);
+    auto spinning = measure_feed_latency(true, COUNT);
+    print_latency("ioc.poll() busy-poll", spinning);
+}
+
+// ----- reactor 对比：epoll vs io_uring -----
+// 同一份 bench 分别用 -DAGGREGATOR_IO_URING=OFF/ON 编译后各跑一次 ./bench netio 对比
+// 背靠背推送时每条消息一次 async_read 完成，报告吞吐和 io 线程每条消息的 CPU；
+// 再按 100us 间隔测一次延迟，对应真实行情的稀疏到达
+int64_t thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+void bench_netio() {
+    constexpr std::size_t BURST = 500'000;
+    constexpr std::size_t PACED = 20'000;
+    std::printf("[netio] asio reactor: %s, %zu-byte frames over loopback mock feed\n", io_backend_name(), FEED_FRAME);
+    pin_current_thread(core_from_env("BENCH_IO_CORE"), "io");
+
+    int64_t cpu0 = thread_cpu_ns();
+    int64_t wall0 = now_ns();
+    auto burst = measure_feed_latency(false, BURST, std::chrono::microseconds(0));
+    int64_t wall = now_ns() - wall0;
+    int64_t cpu = thread_cpu_ns() - cpu0;
+    std::printf("  %-34s %10.0f msg/s  %8.1f io-thread cpu ns/msg  (%.0f%% of a core)\n", "back-to-back throughput",
+                burst.size() * 1e9 / wall, double(cpu) / burst.size(), 100.0 * cpu / wall);
+    print_latency("back-to-back (incl. queueing)", burst);
+
+    auto paced = measure_feed_latency(false, PACED);
+    print_latency("paced @ 100us", paced);
+}
+
+// ----- permessage-deflate 的解压成本 -----
+// 用 Beast websocket 内部同一套 zlib 实现：合成 depth20 推送，连续压缩（保留上下文，
+// 与 permessage-deflate 默认的 context takeover 一致），再测逐条 inflate 的 CPU
+std::vector<std::string> make_depth_messages(std::size_t n) {
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> drift(-3, 3);
+    std::uniform_real_distribution<> qty(0.001, 5.0);
+    std::vector<std::string> msgs;
+    msgs.reserve(n);
+    int mid = 7000000;
+    char buf[64];
+    for (std::size_t i = 0; i < n; ++i) {
+        mid += drift(gen);
+        std::string m = "{\"lastUpdateId\":" + std::to_string(1000000 + i) + ",\"bids\":[";
+        for (int l = 0; l < 20; ++l) {
+            std::snprintf(buf, sizeof(buf), "%s[\"%.2f\",\"%.8f\"]", l ? "," : "", (mid - l) / 100.0, qty(gen));
+            m += buf;
+        }
+        m += "],\"asks\":[";
+        for (int l = 0; l < 20; ++l) {
+            std::snprintf(buf, sizeof(buf), "%s[\"%.2f\",\"%.8f\"]", l ? "," : "", (mid + 1 + l) / 100.0, qty(gen));
+            m += buf;
+        }
+        m += "]}";
+        msgs.push_back(std::move(m));
+    }
+    return msgs;
+}
+
+void bench_deflate() {
+    namespace zlib = boost::beast::zlib;
+    constexpr std::size_t COUNT = 20'000;
+    auto msgs = make_depth_messages(COUNT);
+
+    std::vector<std::vector<unsigned char>> frames;
+    frames.reserve(COUNT);
+    std::size_t raw_bytes = 0, wire_bytes = 0;
+    {
+        zlib::deflate_stream ds;
+        ds.reset(6, 15, 8, zlib::Strategy::normal);
+        std::vector<unsigned char> out(64 * 1024);
+        for (const auto& m : msgs) {
+            zlib::z_params zs;
+            zs.next_in = m.data();
+            zs.avail_in = m.size();
+            zs.next_out = out.data();
+            zs.avail_out = out.size();
+            boost::system::error_code ec;
+            ds.write(zs, zlib::Flush::sync, ec);
+            frames.emplace_back(out.data(), out.data() + (out.size() - zs.avail_out));
+            raw_bytes += m.size();
+            wire_bytes += frames.back().size();
+        }
+    }
+    std::printf("[deflate] %zu depth20 messages, avg %.0f B raw -> %.0f B deflated (ratio %.3f)\n",
+                COUNT, double(raw_bytes) / COUNT, double(wire_bytes) / COUNT, double(wire_bytes) / raw_bytes);
+
+    zlib::inflate_stream is;
+    is.reset(15);
+    std::vector<unsigned char> out(64 * 1024);
+    auto m = measure(COUNT, [&] {
+        for (const auto& f : frames) {
+            zlib::z_params zs;
+            zs.next_in = f.data();
+            zs.avail_in = f.size();
+            zs.next_out = out.data();
+            zs.avail_out = out.size();
+            boost::system::error_code ec;
+            is.write(zs, zlib::Flush::sync, ec);
+        }
+    });
+    report("inflate per message", m);
+    std::printf("  %-34s %10.1f ns/KB (raw)\n", "inflate throughput", m.ns_per_op * 1024.0 / (double(raw_bytes) / COUNT));
+}
+
+// ----- 每条消息的分派：虚函数链 vs 编译期 venue traits -----
+// 旧结构：on_read -> 虚 handle_message -> 虚 parse_message -> set_level
+// 新结构：on_read -> 虚 deliver（final 模板）-> traits::parse 内联 -> set_level
+// set_level 两边都是跨编译单元调用（noinline 模拟），差别只在分派
+struct level_sink {
+    bid_book bids;
+    ask_book asks;
+    explicit level_sink(book_memory& mem) : bids(mem.resource()), asks(mem.resource()) {}
+
+    __attribute__((noinline)) void set_level(bool bid, double price, double qty) {
+        if (bid) bids[price] = qty;
+        else asks[price] = qty;
+    }
+};
+
+// 轻量解析：只取最优买价（就在消息开头），突出分派本身的开销
+template <class Sink>
+inline void parse_top(Sink& sink, const std::string& msg) {
+    std::size_t p = msg.find("[\"", 20);
+    if (p == std::string::npos) return;
+    double price = std::strtod(msg.c_str() + p + 2, nullptr);
+    sink.set_level(true, price, 1.0);
+}
+
+// 完整解析：与连接器里一样用 nlohmann::json
+template <class Sink>
+inline void parse_full(Sink& sink, const std::string& msg) {
+    auto j = nlohmann::json::parse(msg);
+    for (const auto& l : j["bids"]) sink.set_level(true, std::stod(l[0].get<std::string>()), std::stod(l[1].get<std::string>()));
+    for (const auto& l : j["asks"]) sink.set_level(false, std::stod(l[0].get<std::string>()), std::stod(l[1].get<std::string>()));
+}
+
+struct virtual_connector : level_sink {
+    using level_sink::level_sink;
+    virtual ~virtual_connector() = default;
+    virtual void handle_message(const std::string& msg) { parse_message(msg); }
+    virtual void parse_message(const std::string& msg) = 0;
+};
+
+template <bool Full>
+struct virtual_binance : virtual_connector {
+    using virtual_connector::virtual_connector;
+    void handle_message(const std::string& msg) override { virtual_connector::handle_message(msg); }
+    void parse_message(const std::string& msg) override {
+        if (Full) parse_full(*this, msg);
+        else parse_top(*this, msg);
+    }
+};
+
+struct deliver_base : level_sink {
+    using level_sink::level_sink;
+    virtual ~deliver_base() = default;
+    virtual void deliver(const std::string& msg) = 0;
+};
+
+template <bool Full>
+struct traits_venue {
+    template <class C>
+    static void parse(C& c, const std::string& msg) {
+        if (Full) parse_full(c, msg);
+        else parse_top(c, msg);
+    }
+};
+
+template <class Venue>
+struct traits_connector final : deliver_base {
+    using deliver_base::deliver_base;
+    void deliver(const std::string& msg) override { Venue::parse(*this, msg); }
+};
+
+// noinline + 基类引用：不让编译器在调用点把虚调用去掉
+__attribute__((noinline)) void feed_virtual(virtual_connector& c, const std::vector<std::string>& msgs) {
+    for (const auto& m : msgs) c.handle_message(m);
+}
+__attribute__((noinline)) void feed_traits(deliver_base& c, const std::vector<std::string>& msgs) {
+    for (const auto& m : msgs) c.deliver(m);
+}
+
+template <bool Full>
+void bench_dispatch_variant(const char* label, const std::vector<std::string>& msgs, std::size_t rounds) {
+    book_memory mem;
+    virtual_binance<Full> old_style(mem);
+    traits_connector<traits_venue<Full>> new_style(mem);
+    std::size_t ops = msgs.size() * rounds;
+
+    // 交替跑几轮取最小值，减少频率 / 缓存预热带来的顺序偏差
+    measurement v{1e18, 0}, t{1e18, 0};
+    for (int i = 0; i < 5; ++i) {
+        auto a = measure(ops, [&] { for (std::size_t r = 0; r < rounds; ++r) feed_virtual(old_style, msgs); });
+        auto b = measure(ops, [&] { for (std::size_t r = 0; r < rounds; ++r) feed_traits(new_style, msgs); });
+        if (a.ns_per_op < v.ns_per_op) v = a;
+        if (b.ns_per_op < t.ns_per_op) t = b;
+    }
+    std::printf(" %s\n", label);
+    report("virtual handle/parse chain", v);
+    report("venue traits (one virtual deliver)", t);
+    std::printf("  %-34s %10.1f ns/msg\n", "saving", v.ns_per_op - t.ns_per_op);
+}
+
+void bench_dispatch() {
+    auto msgs = make_depth_messages(2'000);
+    std::printf("[dispatch] per-message read->parse->apply dispatch, depth20 messages\n");
+    bench_dispatch_variant<false>("top-of-book scan (dispatch dominated)", msgs, 500);
+    bench_dispatch_variant<true>("full nlohmann parse (as in connectors)", msgs, 5);
+}
+
+// ----- 累计深度：线性扫描 vs 前缀和索引 -----
+// 5000 档买方簿（0.01 网格，每档 0.5~5），查 7 个金额档位达到的价位；同时测索引的增量更新开销
+void bench_depth() {
+    constexpr int LEVELS = 5000;
+    constexpr std::size_t ROUNDS = 20'000;
+    const double bands[] = {0.01e6, 0.10e6, 1.00e6, 5.00e6, 10.00e6, 25.00e6, 50.00e6};
+    std::printf("[depth] %d-level bid book, %zu queries of %zu notional bands\n", LEVELS, ROUNDS, std::size(bands));
+
+    book_memory mem;
+    consolidated_bid_book bids(mem.resource());
+    consolidated_ask_book asks(mem.resource());
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<> qty(0.5, 5.0);
+    for (int i = 0; i < LEVELS; ++i) apply_venue_level(bids, 0, 70000.0 - i * 0.01, qty(gen));
+
+    depth_index index(depth_index_config{0.01, 1u << 20});
+    index.rebuild(bids, asks);
+
+    double sink = 0.0;
+    report("linear scan from top (per band)", measure(ROUNDS * std::size(bands), [&] {
+        for (std::size_t r = 0; r < ROUNDS; ++r) {
+            double cum = 0.0;
+            std::size_t band = 0;
+            for (const auto& [price, lvl] : bids) {
+                cum += price * lvl.total;
+                while (band < std::size(bands) && cum >= bands[band]) { sink += price; ++band; }
+                if (band == std::size(bands)) break;
+            }
+        }
+    }));
+    report("depth_index::to_notional (per band)", measure(ROUNDS * std::size(bands), [&] {
+        for (std::size_t r = 0; r < ROUNDS; ++r) {
+            for (double b : bands) sink += index.to_notional(book_side::bid, b).price;
+        }
+    }));
+
+    auto ops = make_level_ops(1'000'000);
+    report("apply_venue_level only", measure(ops.size(), [&] {
+        for (const auto& op : ops) sink += apply_venue_level(bids, 0, op.price, op.qty);
+    }));
+    report("apply_venue_level + index update", measure(ops.size(), [&] {
+        for (const auto& op : ops) index.on_level_changed(book_side::bid, op.price, apply_venue_level(bids, 0, op.price, op.qty));
+    }));
+    if (sink == 42.0) std::printf("\n");   // 防止结果被优化掉
+}
+
+struct suite {
+    const char* name;
+    std::function<void()> run;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::vector<suite> suites = {
+        {"book_updates", bench_book_updates},
+        {"consolidation", bench_consolidation},
+        {"wakeup", bench_wakeup},
+        {"netio", bench_netio},
+        {"deflate", bench_deflate},
+        {"dispatch", bench_dispatch},
+        {"depth", bench_depth},
+    };
+
+    for (const auto& s : suites) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], s.name) == 0) selected = true;
+        }
+        if (!selected) continue;
+
+        // bench 不跑连接器到推送的完整流水线，不按阶段拆分，只报整个场景的总数
+        const std::size_t allocs_before = g_alloc_count.load(std::memory_order_relaxed);
+        const std::size_t bytes_before = g_alloc_bytes.load(std::memory_order_relaxed);
+        s.run();
+        std::printf("  suite total: %zu allocs, %zu B\n",
+                    g_alloc_count.load(std::memory_order_relaxed) - allocs_before,
+                    g_alloc_bytes.load(std::memory_order_relaxed) - bytes_before);
+    }
+    return 0;
+}
@@ -4,45 +4,36 @@
 
 using json = nlohmann::json;
 
-binance_connector::binance_connector(net::io_context& ioc,
-                                     Aggregator* aggregator, 
-                                     std::string name, 
-                                     std::string host, 
-                                     std::string port, 
-                                     std::string path, 
-                                     event_callback cb)
-    : market_connector(ioc, aggregator, name, host, port, path, cb) {}        
+template class venue_connector<binance_venue>;
 
-std::string binance_connector::subscription_message() const {
-    // Binance auto-subscribes via URL path, no message needed
-    return "";
-}
-
-void binance_connector::handle_message(const std::string& msg) {
-    // callback_("Binance", msg);
-    market_connector::handle_message(msg);  // Call base
-}
-
-void binance_connector::parse_message(const std::string& msg) {
+void binance_venue::parse(binance_connector& c, const std::string& msg) {
   try {
     json j = json::parse(msg);
     if (j.contains("lastUpdateId")) {
-      local_bids_.clear();
-      local_asks_.clear();
+      // depth20 每条都是全量快照
+      c.begin_snapshot();
 
       for (const auto& bid : j["bids"]) {
         double price = std::stod(bid[0].get<std::string>());
         double qty = std::stod(bid[1].get<std::string>());
-        local_bids_[price] = qty;
+        c.set_level(book_side::bid, price, qty);
       }
 
       for (const auto& ask : j["asks"]) {
         double price = std::stod(ask[0].get<std::string>());
         double qty = std::stod(ask[1].get<std::string>());
-        local_asks_[price] = qty;
+        c.set_level(book_side::ask, price, qty);
       }
+
+      c.end_snapshot();
+    } else if (j.value("e", "") == "trade") {
+      // m = 买方是挂单方，即卖方主动
+      c.add_trade(j["m"].get<bool>() ? book_side::ask : book_side::bid,
+                  std::stod(j["p"].get<std::string>()), std::stod(j["q"].get<std::string>()),
+                  j["T"].get<int64_t>(), j["t"].get<uint64_t>());
     }
   } catch (const std::exception& e) {
-    std::cerr << "[" << name_ << "] Parse error: " << e.what() << std::endl;
+    c.note_parse_error();
+    std::cerr << "[" << c.name() << "] Parse error: " << e.what() << std::endl;
   }
 }
\ No newline at end of file
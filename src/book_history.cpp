@@ -0,0 +1,127 @@
+#include "book_history.h"
+#include <algorithm>
+#include <iterator>
+
+history_config parse_history_config(const nlohmann::json& j) {
+    history_config cfg;
+    if (!j.is_object()) return cfg;
+
+    cfg.seconds = std::max(0, j.value("seconds", cfg.seconds));
+    cfg.checkpoint_deltas = std::max<std::size_t>(1, j.value("checkpoint_deltas", cfg.checkpoint_deltas));
+    cfg.checkpoint_interval_ms = std::max(1, j.value("checkpoint_interval_ms", cfg.checkpoint_interval_ms));
+    // 至少容得下两个检查点之间的变化，否则只剩一个检查点时无法淘汰
+    cfg.max_deltas = std::max(2 * cfg.checkpoint_deltas, j.value("max_deltas", cfg.max_deltas));
+    return cfg;
+}
+
+book_history::book_history(history_config cfg) : cfg_(cfg) {
+    pending_.reserve(1024);
+}
+
+void book_history::add(std::size_t venue, const level_change& change) {
+    pending_.push_back({change.price, change.qty, static_cast<uint8_t>(venue), change.side});
+}
+
+void book_history::commit(int64_t ts_ns, uint64_t version,
+                          const consolidated_bid_book& bids, const consolidated_ask_book& asks) {
+    // 时钟回拨时沿用上一个时间，保证 versions_ 按时间有序，查询可以二分
+    ts_ns = std::max(ts_ns, last_ts_ns_);
+    last_ts_ns_ = ts_ns;
+
+    since_checkpoint_ += pending_.size();
+    const bool take = !has_checkpoint_ || since_checkpoint_ >= cfg_.checkpoint_deltas ||
+                      (since_checkpoint_ > 0 &&
+                       ts_ns - last_checkpoint_ns_ >= cfg_.checkpoint_interval_ms * 1'000'000LL);
+
+    // 检查点在锁外拷贝，查询线程只会在锁内等一次 push_back
+    std::shared_ptr<checkpoint> cp;
+    if (take) {
+        cp = std::make_shared<checkpoint>();
+        cp->ts_ns = ts_ns;
+        cp->bids.assign(bids.begin(), bids.end());
+        cp->asks.assign(asks.begin(), asks.end());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 检查点已包含本版本的变化，查询不会重放它们，不用保存
+        if (!cp) deltas_.insert(deltas_.end(), pending_.begin(), pending_.end());
+        const uint64_t delta_end = first_delta_ + deltas_.size();
+        versions_.push_back({ts_ns, version, delta_end});
+        if (cp) {
+            cp->version_pos = first_version_ + versions_.size() - 1;
+            cp->delta_pos = delta_end;
+            checkpoint_levels_ += cp->bids.size() + cp->asks.size();
+            checkpoints_.push_back(std::move(cp));
+        }
+        evict(ts_ns);
+    }
+    pending_.clear();
+
+    if (take) {
+        has_checkpoint_ = true;
+        last_checkpoint_ns_ = ts_ns;
+        since_checkpoint_ = 0;
+    }
+}
+
+void book_history::evict(int64_t now_ns) {
+    const int64_t keep_from = now_ns - static_cast<int64_t>(cfg_.seconds) * 1'000'000'000LL;
+    // 第二个检查点已经覆盖保留窗口（或变化总数超限）时，整段丢掉第一个检查点及其后的变化
+    while (checkpoints_.size() >= 2 && (checkpoints_[1]->ts_ns <= keep_from || deltas_.size() > cfg_.max_deltas)) {
+        checkpoint_levels_ -= checkpoints_.front()->bids.size() + checkpoints_.front()->asks.size();
+        checkpoints_.pop_front();
+
+        const checkpoint& head = *checkpoints_.front();
+        versions_.erase(versions_.begin(), versions_.begin() + (head.version_pos - first_version_));
+        first_version_ = head.version_pos;
+        deltas_.erase(deltas_.begin(), deltas_.begin() + (head.delta_pos - first_delta_));
+        first_delta_ = head.delta_pos;
+    }
+}
+
+bool book_history::book_at(int64_t ts_ns, consolidated_bid_book& bids, consolidated_ask_book& asks,
+                           uint64_t& version, int64_t& version_ts_ns) const {
+    std::shared_ptr<const checkpoint> cp;
+    std::vector<delta> replay;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (checkpoints_.empty() || ts_ns < checkpoints_.front()->ts_ns) return false;
+
+        auto cp_it = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), ts_ns,
+                                      [](int64_t t, const auto& c) { return t < c->ts_ns; });
+        cp = *std::prev(cp_it);
+
+        // 检查点自己的版本时间 <= ts_ns，所以 v_it 至少前进一格
+        auto v_begin = versions_.begin() + (cp->version_pos - first_version_);
+        auto v_it = std::upper_bound(v_begin, versions_.end(), ts_ns,
+                                     [](int64_t t, const version_entry& v) { return t < v.ts_ns; });
+        const version_entry& v = *std::prev(v_it);
+        version = v.version;
+        version_ts_ns = v.ts_ns;
+        replay.assign(deltas_.begin() + (cp->delta_pos - first_delta_), deltas_.begin() + (v.delta_end - first_delta_));
+    }
+
+    // 重建在锁外做，不挡 strand 上的 commit
+    bids.clear();
+    asks.clear();
+    for (const auto& [price, lvl] : cp->bids) bids.emplace_hint(bids.end(), price, lvl);
+    for (const auto& [price, lvl] : cp->asks) asks.emplace_hint(asks.end(), price, lvl);
+    for (const auto& d : replay) {
+        if (d.side == book_side::bid) apply_venue_level(bids, d.venue, d.price, d.qty);
+        else apply_venue_level(asks, d.venue, d.price, d.qty);
+    }
+    return true;
+}
+
+book_history::usage book_history::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    usage u;
+    u.versions = versions_.size();
+    u.deltas = deltas_.size();
+    u.checkpoints = checkpoints_.size();
+    u.bytes = deltas_.size() * sizeof(delta) + versions_.size() * sizeof(version_entry) +
+              checkpoint_levels_ * sizeof(std::pair<double, venue_level>);
+    u.from_ns = checkpoints_.empty() ? 0 : checkpoints_.front()->ts_ns;
+    return u;
+}
@@ -0,0 +1,84 @@
+#include "book_signals.h"
+#include <algorithm>
+
+signal_config parse_signal_config(const nlohmann::json& j) {
+    signal_config cfg;
+    if (!j.is_object()) return cfg;
+
+    cfg.imbalance_levels = std::max<std::size_t>(1, j.value("imbalance_levels", cfg.imbalance_levels));
+    cfg.vwap_depth = j.value("vwap_depth", cfg.vwap_depth);
+    return cfg;
+}
+
+book_signals::book_signals(signal_config cfg) : cfg_(cfg) {}
+
+void book_signals::on_level_changed(book_side side, double price) {
+    if (side == book_side::bid) {
+        // 买盘价格降序：比边界价高（或相等）的档位在覆盖区域内
+        if (bid_.covers_all || price >= bid_.boundary) bid_.dirty = true;
+    } else {
+        if (ask_.covers_all || price <= ask_.boundary) ask_.dirty = true;
+    }
+}
+
+template <class Book>
+void book_signals::recompute(side_state& st, const Book& book) {
+    st = side_state{};
+    st.dirty = false;
+
+    std::size_t levels = 0;
+    double filled = 0.0;
+    double notional = 0.0;
+
+    for (const auto& [price, lvl] : book) {
+        bool need_top = levels < cfg_.imbalance_levels;
+        bool need_vwap = filled < cfg_.vwap_depth;
+        if (!need_top && !need_vwap) {
+            st.covers_all = false;
+            break;
+        }
+
+        if (levels == 0) {
+            st.best_price = price;
+            st.best_qty = lvl.total;
+        }
+        if (need_top) st.top_qty += lvl.total;
+        if (need_vwap) {
+            double take = std::min(lvl.total, cfg_.vwap_depth - filled);
+            filled += take;
+            notional += take * price;
+        }
+        st.boundary = price;
+        ++levels;
+    }
+
+    // 走完整本簿仍未满足时 covers_all 保持 true（深度不够，按已有数量计算）
+    st.vwap = filled > 0.0 ? notional / filled : 0.0;
+}
+
+bool book_signals::refresh(const consolidated_bid_book& bids, const consolidated_ask_book& asks) {
+    if (!bid_.dirty && !ask_.dirty) return false;
+
+    if (bid_.dirty) recompute(bid_, bids);
+    if (ask_.dirty) recompute(ask_, asks);
+
+    signal_values v;
+    v.best_bid = bid_.best_price;
+    v.best_ask = ask_.best_price;
+    v.bid_vwap = bid_.vwap;
+    v.ask_vwap = ask_.vwap;
+
+    double top_sum = bid_.top_qty + ask_.top_qty;
+    v.imbalance = top_sum > 0.0 ? (bid_.top_qty - ask_.top_qty) / top_sum : 0.0;
+
+    double best_sum = bid_.best_qty + ask_.best_qty;
+    if (best_sum > 0.0) {
+        v.microprice = (bid_.best_price * ask_.best_qty + ask_.best_price * bid_.best_qty) / best_sum;
+    }
+
+    bool changed = v.best_bid != values_.best_bid || v.best_ask != values_.best_ask ||
+                   v.microprice != values_.microprice || v.imbalance != values_.imbalance ||
+                   v.bid_vwap != values_.bid_vwap || v.ask_vwap != values_.ask_vwap;
+    values_ = v;
+    return changed;
+}
@@ -0,0 +1,159 @@
+#include "book_snapshot.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+
+// 文件布局：header | venue_record * venue_count | level_record * (bid_count + ask_count)
+constexpr char SNAPSHOT_MAGIC[8] = {'A', 'G', 'G', 'S', 'N', 'A', 'P', '1'};
+constexpr std::size_t VENUE_NAME_LEN = 32;
+
+struct file_header {
+    char magic[8];
+    uint32_t max_venues;
+    uint32_t venue_count;
+    int64_t timestamp_ms;
+    uint64_t bid_count;
+    uint64_t ask_count;
+};
+
+struct venue_record {
+    char name[VENUE_NAME_LEN];
+    int64_t last_update_ms;
+};
+
+struct level_record {
+    double price;
+    venue_level level;
+};
+
+}  // namespace
+
+snapshot_config parse_snapshot_config(const nlohmann::json& j) {
+    snapshot_config cfg;
+    if (!j.is_object()) return cfg;
+
+    cfg.path = j.value("path", cfg.path);
+    cfg.interval_ms = j.value("interval_ms", cfg.interval_ms);
+    return cfg;
+}
+
+bool save_book_snapshot(const std::string& path, const book_snapshot& snap) {
+    const std::size_t size = sizeof(file_header) +
+                             snap.venues.size() * sizeof(venue_record) +
+                             (snap.bids.size() + snap.asks.size()) * sizeof(level_record);
+
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "[snapshot] Cannot open " << tmp_path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        std::cerr << "[snapshot] ftruncate failed: " << strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    void* base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        std::cerr << "[snapshot] mmap failed: " << strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    auto* header = static_cast<file_header*>(base);
+    std::memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header->max_venues = MAX_VENUES;
+    header->venue_count = static_cast<uint32_t>(snap.venues.size());
+    header->timestamp_ms = snap.timestamp_ms;
+    header->bid_count = snap.bids.size();
+    header->ask_count = snap.asks.size();
+
+    auto* venues = reinterpret_cast<venue_record*>(header + 1);
+    for (std::size_t i = 0; i < snap.venues.size(); ++i) {
+        std::memset(venues[i].name, 0, VENUE_NAME_LEN);
+        std::strncpy(venues[i].name, snap.venues[i].name.c_str(), VENUE_NAME_LEN - 1);
+        venues[i].last_update_ms = snap.venues[i].last_update_ms;
+    }
+
+    auto* levels = reinterpret_cast<level_record*>(venues + snap.venues.size());
+    for (const auto& [price, lvl] : snap.bids) *levels++ = {price, lvl};
+    for (const auto& [price, lvl] : snap.asks) *levels++ = {price, lvl};
+
+    // rename 之前先落盘，崩溃后不会出现改了名但内容为空或写了一半的快照
+    bool synced = ::msync(base, size, MS_SYNC) == 0 && ::fsync(fd) == 0;
+    ::munmap(base, size);
+    ::close(fd);
+    if (!synced) {
+        std::cerr << "[snapshot] sync failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "[snapshot] rename failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // rename 本身记在目录里，目录也要 fsync
+    const std::string::size_type slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0 || ::fsync(dir_fd) != 0) {
+        std::cerr << "[snapshot] fsync " << dir << " failed: " << strerror(errno) << std::endl;
+    }
+    if (dir_fd >= 0) ::close(dir_fd);
+    return true;
+}
+
+bool load_book_snapshot(const std::string& path, book_snapshot& out) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;  // 第一次启动没有快照是正常情况
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(file_header)) {
+        ::close(fd);
+        return false;
+    }
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+
+    void* base = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) return false;
+
+    const auto* header = static_cast<const file_header*>(base);
+    const std::size_t expected = sizeof(file_header) +
+                                 header->venue_count * sizeof(venue_record) +
+                                 (header->bid_count + header->ask_count) * sizeof(level_record);
+    bool ok = std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+              header->max_venues == MAX_VENUES &&
+              header->venue_count <= MAX_VENUES &&
+              expected == size;
+    if (!ok) {
+        std::cerr << "[snapshot] Ignoring incompatible snapshot " << path << std::endl;
+        ::munmap(base, size);
+        return false;
+    }
+
+    out.timestamp_ms = header->timestamp_ms;
+    const auto* venues = reinterpret_cast<const venue_record*>(header + 1);
+    out.venues.clear();
+    for (uint32_t i = 0; i < header->venue_count; ++i) {
+        out.venues.push_back({std::string(venues[i].name, strnlen(venues[i].name, VENUE_NAME_LEN)),
+                              venues[i].last_update_ms});
+    }
+
+    const auto* levels = reinterpret_cast<const level_record*>(venues + header->venue_count);
+    out.bids.clear();
+    out.asks.clear();
+    for (uint64_t i = 0; i < header->bid_count; ++i, ++levels) out.bids.emplace_back(levels->price, levels->level);
+    for (uint64_t i = 0; i < header->ask_count; ++i, ++levels) out.asks.emplace_back(levels->price, levels->level);
+
+    ::munmap(base, size);
+    return true;
+}
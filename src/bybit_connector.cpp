@@ -4,29 +4,9 @@
 
 using json = nlohmann::json;
 
-bybit_connector::bybit_connector(net::io_context& ioc,
-                                 Aggregator* aggregator,
-                                 std::string name,
-                                 std::string host,
-                                 std::string port,
-                                 std::string path,
-                                 event_callback cb)
-    : market_connector(ioc, aggregator, name, host, port, path, cb) {}
-
-std::string bybit_connector::subscription_message() const {
-    // Bybit 现货 50 档深度，100ms 推送
-    return R"({
-        "op": "subscribe",
-        "args": ["orderbook.50.BTCUSDT"]
-    })";
-}
-
-void bybit_connector::handle_message(const std::string& msg) {
-    // callback_("Bybit", msg);
-    market_connector::handle_message(msg);
-}
+template class venue_connector<bybit_venue>;
 
-void bybit_connector::parse_message(const std::string& msg) {
+void bybit_venue::parse(bybit_connector& c, const std::string& msg) {
     try {
         auto j = json::parse(msg);
 
@@ -41,6 +21,16 @@ void bybit_connector::parse_message(const std::string& msg) {
             return;
         }
 
+        if (j.contains("topic") && j["topic"] == "publicTrade.BTCUSDT") {
+            for (const auto& t : j["data"]) {
+                // S = 吃单方方向
+                c.add_trade(t["S"] == "Buy" ? book_side::bid : book_side::ask,
+                            std::stod(t["p"].get<std::string>()), std::stod(t["v"].get<std::string>()),
+                            t["T"].get<int64_t>(), std::stoull(t["i"].get<std::string>()));
+            }
+            return;
+        }
+
         if (!j.contains("topic") || j["topic"] != "orderbook.50.BTCUSDT") {
             return;
         }
@@ -52,20 +42,21 @@ void bybit_connector::parse_message(const std::string& msg) {
 
         // ===== SNAPSHOT =====
         if (j.contains("type") && j["type"] == "snapshot") {
-            local_bids_.clear();
-            local_asks_.clear();
+            c.begin_snapshot();
 
             for (const auto& level : data["b"]) {
                 double price = std::stod(level[0].get<std::string>());
                 double qty   = std::stod(level[1].get<std::string>());
-                if (qty > 0.0) local_bids_[price] = qty;
+                c.set_level(book_side::bid, price, qty);
             }
 
             for (const auto& level : data["a"]) {
                 double price = std::stod(level[0].get<std::string>());
                 double qty   = std::stod(level[1].get<std::string>());
-                if (qty > 0.0) local_asks_[price] = qty;
+                c.set_level(book_side::ask, price, qty);
             }
+
+            c.end_snapshot();
         }
         // ===== DELTA =====
         else if (j.contains("type") && j["type"] == "delta") {
@@ -73,10 +64,7 @@ void bybit_connector::parse_message(const std::string& msg) {
                 for (const auto& level : data["b"]) {
                     double price = std::stod(level[0].get<std::string>());
                     double qty   = std::stod(level[1].get<std::string>());
-                    if (qty == 0.0)
-                        local_bids_.erase(price);
-                    else
-                        local_bids_[price] = qty;
+                    c.set_level(book_side::bid, price, qty);  // qty == 0 删除
                 }
             }
 
@@ -84,10 +72,7 @@ void bybit_connector::parse_message(const std::string& msg) {
                 for (const auto& level : data["a"]) {
                     double price = std::stod(level[0].get<std::string>());
                     double qty   = std::stod(level[1].get<std::string>());
-                    if (qty == 0.0)
-                        local_asks_.erase(price);
-                    else
-                        local_asks_[price] = qty;
+                    c.set_level(book_side::ask, price, qty);
                 }
             }
         }
@@ -97,6 +82,7 @@ void bybit_connector::parse_message(const std::string& msg) {
         // }
 
     } catch (const std::exception& e) {
+        c.note_parse_error();
         std::cerr << "[Bybit] Parse error: " << e.what() << "\n";
     }
 }
@@ -13,7 +13,7 @@ using grpc::ClientContext;
 using grpc::Status;
 using aggregator::AggregatorService;
 using aggregator::SubscribeRequest;
-using aggregator::BookUpdate;
+using aggregator::BBO;
 
 // ANSI 颜色宏定义（必须放在文件顶部）
 #define COLOR_RED     "\033[31m"     // 红色
@@ -44,23 +44,23 @@ public:
             SubscribeRequest request;
             request.set_symbol("BTCUSDT");
 
-            std::unique_ptr<grpc::ClientReader<BookUpdate>> reader(
-                stub->SubscribeBook(&context, request));
+            std::unique_ptr<grpc::ClientReader<BBO>> reader(
+                stub->SubscribeBBO(&context, request));
 
             std::cout << "[BBO] Connected to " << target_ << ", subscribing to BTCUSDT..." << std::endl;
 
-            BookUpdate update;
+            BBO update;
             bool connected = true;
 
             while (reader->Read(&update)) {
-                if (update.bids().empty() || update.asks().empty()) {
+                if (update.bid_qty() <= 0.0 || update.ask_qty() <= 0.0) {
                     continue;
                 }
 
-                double bid_price = update.bids(0).price();
-                double bid_qty   = update.bids(0).quantity();
-                double ask_price = update.asks(0).price();
-                double ask_qty   = update.asks(0).quantity();
+                double bid_price = update.bid_price();
+                double bid_qty   = update.bid_qty();
+                double ask_price = update.ask_price();
+                double ask_qty   = update.ask_qty();
 
                 // 计算 crossed 警告（保留小数点后 2 位）
                 double spread = bid_price - ask_price;
@@ -82,51 +82,22 @@ public:
                     << "." << std::setfill('0') << std::setw(3) << ms.count();
 
                 // 输出指定格式 + 颜色
-                std::cout << "=== BBO Update @ " << oss.str() << " Local ===\n"
+                std::cout << "=== BBO Update #" << update.seq() << " @ " << oss.str() << " Local ===\n"
                           << "Best Ask: " << COLOR_BLUE << std::fixed << std::setprecision(2) << ask_price
                           << COLOR_RESET << " @ " << std::fixed << std::setprecision(8) << ask_qty << "\n"
                           << "Best Bid: " << COLOR_RED << std::fixed << std::setprecision(2) << bid_price
                           << COLOR_RESET << " @ " << std::fixed << std::setprecision(8) << bid_qty << warning << "\n"
-                          << "==============================================\n";
-                if(1){
-                    int max_level = 10;
-                    // std::cout << "Top 10 Asks:\n";
-                    // for (int i = 0; i < std::min(max_level, update.asks_size()); ++i) {
-                    //     const auto& lvl = update.asks(i);
-                    //     std::cout << "  " << std::setw(2) << i+1
-                    //             << " | Price: " << COLOR_BLUE << std::fixed << std::setprecision(2) << lvl.price()
-                    //             << COLOR_RESET
-                    //             << " | Qty: " << std::fixed << std::setprecision(8) << lvl.quantity() << "\n";
-                    // }
-
-                    std::cout << std::fixed << std::setprecision(2);
-
-                    std::cout << "Top 10 Asks:\n";
-                    std::cout << "----------------------------------------------\n";
-
-                    int ask_size = update.asks_size();
-                    int ask_start = std::max(0, ask_size - max_level);  // 最多取最后 10 个（最低价）
-
-                    // 从最低价（第10个）开始输出，序号从 10 递减到 1（最高价在最后）
-                    int display_num = 1;
-                    for (int i = max_level ; i >0 ; --i) {
-                        const auto& lvl = update.asks(i);
-                        std::cout << "  " << std::setw(2) << (max_level - display_num + 1)
-                                << " | Price: " << COLOR_BLUE << std::setprecision(2) << lvl.price() << COLOR_RESET
-                                << " | Qty: " << std::setprecision(8) << lvl.quantity() << "\n";
-                        display_num++;
-                    }
-                    std::cout << "----------------------------------------------\n";
-                    std::cout << "Top 10 Bids:\n";
-                    for (int i = 0; i < std::min(max_level, update.bids_size()); ++i) {
-                        const auto& lvl = update.bids(i);
-                        std::cout << "  " << std::setw(2) << i+1
-                                << " | Price: " << COLOR_RED << std::fixed << std::setprecision(2) << lvl.price()
-                                << COLOR_RESET
-                                << " | Qty: " << std::fixed << std::setprecision(8) << lvl.quantity() << "\n";
-                    }
-                    std::cout << "==============================================\n";
+                          << "----------------------------------------------\n";
+
+                // 各交易所自己的最优价
+                for (const auto& v : update.venues()) {
+                    std::cout << "  " << std::left << std::setw(8) << std::setfill(' ') << v.venue() << std::right
+                              << " | Bid: " << COLOR_RED << std::setprecision(2) << v.bid_price() << COLOR_RESET
+                              << " @ " << std::setprecision(8) << v.bid_qty()
+                              << " | Ask: " << COLOR_BLUE << std::setprecision(2) << v.ask_price() << COLOR_RESET
+                              << " @ " << std::setprecision(8) << v.ask_qty() << "\n";
                 }
+                std::cout << "==============================================\n";
                 // 读取成功，重置重试计数
                 retry_count = 0;
             }
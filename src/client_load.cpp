@@ -0,0 +1,166 @@
+// 扇出压测客户端：同时打开 N 条 SubscribeBook 流，只解码不打印，
+// 每秒汇报总速率，结束时输出每条流的更新速率、字节数和端到端延迟
+// 用法: client_load [target] [streams] [seconds] [--venues] [--shared-channel]
+// 延迟 = 收到时间 - BookUpdate.timestamp_ns（服务端发布该版本的时间，含推送线程的等待），跨机器时依赖时钟同步
+// 服务端处理 = timestamp_ns - rx_timestamp_ns（交易所消息的内核接收时间），同一台机器上的时钟
+#include <grpcpp/grpcpp.h>
+#include "aggregator.grpc.pb.h"
+#include "aggregator.pb.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using grpc::Channel;
+using grpc::ClientContext;
+using grpc::Status;
+using aggregator::AggregatorService;
+using aggregator::SubscribeRequest;
+using aggregator::BookUpdate;
+
+namespace {
+
+int64_t wall_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+struct stream_stats {
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes{0};
+    std::vector<int64_t> latency_ns;   // 只在流线程里写，join 之后再读
+    std::vector<int64_t> server_ns;
+    bool failed = false;
+    std::string error;
+};
+
+int64_t percentile(std::vector<int64_t>& v, double p) {
+    if (v.empty()) return 0;
+    std::size_t k = static_cast<std::size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+std::shared_ptr<Channel> make_channel(const std::string& target, bool shared) {
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(-1);
+    // 默认每条流单独一个 TCP 连接，模拟相互独立的订阅者；gRPC 默认会复用同参数的子通道
+    if (!shared) args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    return grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), args);
+}
+
+void run_stream(const std::shared_ptr<Channel>& channel, ClientContext* context, bool with_venues,
+                stream_stats& stats) {
+    std::unique_ptr<AggregatorService::Stub> stub(AggregatorService::NewStub(channel));
+
+    SubscribeRequest request;
+    request.set_symbol("BTCUSDT");
+    request.set_with_venues(with_venues);
+
+    std::unique_ptr<grpc::ClientReader<BookUpdate>> reader(stub->SubscribeBook(context, request));
+
+    BookUpdate update;
+    while (reader->Read(&update)) {
+        int64_t now = wall_ns();
+        int64_t sent = update.timestamp_ns() ? update.timestamp_ns() : update.timestamp_ms() * 1'000'000LL;
+        stats.latency_ns.push_back(now - sent);
+        if (update.rx_timestamp_ns() > 0) stats.server_ns.push_back(sent - update.rx_timestamp_ns());
+        stats.bytes.fetch_add(update.ByteSizeLong(), std::memory_order_relaxed);
+        stats.messages.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Status status = reader->Finish();
+    if (!status.ok() && status.error_code() != grpc::StatusCode::CANCELLED) {
+        stats.failed = true;
+        stats.error = status.error_message();
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string target = "localhost:50051";
+    int streams = 10;
+    int seconds = 30;
+    bool with_venues = false;
+    bool shared_channel = false;
+
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--venues") == 0) with_venues = true;
+        else if (std::strcmp(argv[i], "--shared-channel") == 0) shared_channel = true;
+        else if (positional == 0) { target = argv[i]; ++positional; }
+        else if (positional == 1) { streams = std::max(1, std::atoi(argv[i])); ++positional; }
+        else if (positional == 2) { seconds = std::max(1, std::atoi(argv[i])); ++positional; }
+    }
+
+    std::cout << "[Load] " << streams << " SubscribeBook streams to " << target << " for " << seconds << " s"
+              << (with_venues ? ", with venues" : "") << (shared_channel ? ", shared channel" : "") << std::endl;
+
+    std::vector<std::unique_ptr<stream_stats>> stats;
+    std::vector<std::unique_ptr<ClientContext>> contexts;
+    std::vector<std::thread> threads;
+    std::shared_ptr<Channel> shared = shared_channel ? make_channel(target, true) : nullptr;
+
+    for (int i = 0; i < streams; ++i) {
+        stats.push_back(std::make_unique<stream_stats>());
+        stats.back()->latency_ns.reserve(static_cast<std::size_t>(seconds) * 1000);
+        contexts.push_back(std::make_unique<ClientContext>());
+        auto channel = shared ? shared : make_channel(target, false);
+        threads.emplace_back(run_stream, channel, contexts.back().get(), with_venues, std::ref(*stats.back()));
+    }
+
+    // 每秒一行：所有流合计的更新速率和带宽
+    uint64_t last_messages = 0, last_bytes = 0;
+    for (int s = 1; s <= seconds; ++s) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t messages = 0, bytes = 0;
+        for (const auto& st : stats) {
+            messages += st->messages.load(std::memory_order_relaxed);
+            bytes += st->bytes.load(std::memory_order_relaxed);
+        }
+        std::printf("[Load] t=%ds %llu upd/s, %.2f MB/s, %.1f upd/s per stream\n", s,
+                    static_cast<unsigned long long>(messages - last_messages),
+                    (bytes - last_bytes) / 1e6, static_cast<double>(messages - last_messages) / streams);
+        last_messages = messages;
+        last_bytes = bytes;
+    }
+
+    for (auto& ctx : contexts) ctx->TryCancel();
+    for (auto& t : threads) t.join();
+
+    std::printf("%6s %10s %10s %10s %10s %10s %10s\n", "stream", "updates", "upd/s", "MB", "p50_us", "p99_us", "max_us");
+    std::vector<int64_t> all, server;
+    for (int i = 0; i < streams; ++i) {
+        auto& st = *stats[i];
+        uint64_t messages = st.messages.load();
+        all.insert(all.end(), st.latency_ns.begin(), st.latency_ns.end());
+        server.insert(server.end(), st.server_ns.begin(), st.server_ns.end());
+        int64_t p50 = percentile(st.latency_ns, 0.50);
+        int64_t p99 = percentile(st.latency_ns, 0.99);
+        int64_t max = st.latency_ns.empty() ? 0 : *std::max_element(st.latency_ns.begin(), st.latency_ns.end());
+        std::printf("%6d %10llu %10.1f %10.2f %10lld %10lld %10lld%s%s\n", i,
+                    static_cast<unsigned long long>(messages), static_cast<double>(messages) / seconds,
+                    st.bytes.load() / 1e6, static_cast<long long>(p50 / 1000), static_cast<long long>(p99 / 1000),
+                    static_cast<long long>(max / 1000), st.failed ? "  FAILED: " : "", st.error.c_str());
+    }
+
+    int64_t max_all = all.empty() ? 0 : *std::max_element(all.begin(), all.end());
+    std::printf("[Load] all streams: %zu updates, p50 %lld us, p99 %lld us, p99.9 %lld us, max %lld us\n",
+                all.size(), static_cast<long long>(percentile(all, 0.50) / 1000),
+                static_cast<long long>(percentile(all, 0.99) / 1000),
+                static_cast<long long>(percentile(all, 0.999) / 1000), static_cast<long long>(max_all / 1000));
+    if (!server.empty()) {
+        std::printf("[Load] server kernel rx -> build: p50 %lld us, p99 %lld us, p99.9 %lld us\n",
+                    static_cast<long long>(percentile(server, 0.50) / 1000),
+                    static_cast<long long>(percentile(server, 0.99) / 1000),
+                    static_cast<long long>(percentile(server, 0.999) / 1000));
+    }
+    return 0;
+}
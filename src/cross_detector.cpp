@@ -0,0 +1,46 @@
+#include "cross_detector.h"
+
+void cross_detector::on_venue_top(std::size_t venue, const std::array<top_of_book, MAX_VENUES>& tops,
+                                  std::size_t venue_count, int64_t now_ns, std::vector<cross_event>& out) {
+    for (std::size_t other = 0; other < venue_count; ++other) {
+        if (other == venue) continue;
+        check_pair(venue, other, tops, now_ns, out);   // 它的买价对别家卖价
+        check_pair(other, venue, tops, now_ns, out);   // 别家买价对它的卖价
+    }
+}
+
+void cross_detector::check_pair(std::size_t bid_venue, std::size_t ask_venue,
+                                const std::array<top_of_book, MAX_VENUES>& tops, int64_t now_ns,
+                                std::vector<cross_event>& out) {
+    const auto& bid = tops[bid_venue];
+    const auto& ask = tops[ask_venue];
+
+    cross_kind kind = cross_kind::none;
+    if (bid.bid_qty > 0.0 && ask.ask_qty > 0.0) {
+        if (bid.bid_price > ask.ask_price) kind = cross_kind::crossed;
+        else if (bid.bid_price == ask.ask_price) kind = cross_kind::locked;
+    }
+
+    auto& st = pairs_[bid_venue][ask_venue];
+    if (kind == cross_kind::none && st.kind == cross_kind::none) return;
+
+    if (kind == cross_kind::none) {
+        // 结束：带上持续时间和结束前最后的价位
+        out.push_back({cross_kind::none, bid_venue, ask_venue, st.bid_price, st.ask_price, st.size,
+                       now_ns, now_ns - st.since_ns});
+        st = pair_state{};
+        return;
+    }
+
+    double size = bid.bid_qty < ask.ask_qty ? bid.bid_qty : ask.ask_qty;
+    if (kind != st.kind) {
+        // locked <-> crossed 也算新事件，持续时间从最初开始算
+        if (st.kind == cross_kind::none) st.since_ns = now_ns;
+        st.kind = kind;
+        out.push_back({kind, bid_venue, ask_venue, bid.bid_price, ask.ask_price, size, now_ns, 0});
+    }
+    // 同一状态内价位 / 数量的变化只记下来，不单独发事件
+    st.bid_price = bid.bid_price;
+    st.ask_price = ask.ask_price;
+    st.size = size;
+}
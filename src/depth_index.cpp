@@ -0,0 +1,246 @@
+#include "depth_index.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+// Fenwick 树，下标 0 起：add 单点加，prefix 求 [0, i] 的和
+void fenwick_add(std::vector<double>& t, std::size_t i, double v) {
+    for (++i; i <= t.size(); i += i & (~i + 1)) t[i - 1] += v;
+}
+
+double fenwick_prefix(const std::vector<double>& t, std::size_t i) {
+    double sum = 0.0;
+    for (++i; i > 0; i -= i & (~i + 1)) sum += t[i - 1];
+    return sum;
+}
+
+// 前缀和第一次 >= x 的下标（二进制倍增，要求各项非负）；都不够时返回 t.size()
+std::size_t fenwick_search(const std::vector<double>& t, double x) {
+    std::size_t pos = 0;
+    std::size_t step = 1;
+    while (step * 2 <= t.size()) step *= 2;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= t.size() && t[pos + step - 1] < x) {
+            pos += step;
+            x -= t[pos - 1];
+        }
+    }
+    return pos;
+}
+
+// 原地 O(n) 建树：先放好各格的值，再把每格加到它的父节点
+void fenwick_build(std::vector<double>& t) {
+    for (std::size_t i = 1; i <= t.size(); ++i) {
+        std::size_t parent = i + (i & (~i + 1));
+        if (parent <= t.size()) t[parent - 1] += t[i - 1];
+    }
+}
+
+// 窗口内的档位（价格, 合并总量），从最优价开始；pos 给出价位在该侧树里的下标
+template <class Book, class Pos>
+std::vector<std::pair<double, double>> window_levels(const Book& book, std::size_t ticks, Pos pos) {
+    std::vector<std::pair<double, double>> out;
+    for (const auto& [price, lvl] : book) {
+        if (pos(price) >= static_cast<int64_t>(ticks)) break;   // 按最优价排序，之后都在窗口外
+        out.emplace_back(price, lvl.total);
+    }
+    return out;
+}
+
+}  // namespace
+
+depth_index_config parse_depth_index_config(const nlohmann::json& j) {
+    depth_index_config cfg;
+    if (!j.is_object()) return cfg;
+
+    cfg.tick = std::max(0.0, j.value("tick", cfg.tick));
+    cfg.ticks = std::max<std::size_t>(1024, j.value("ticks", cfg.ticks));
+    return cfg;
+}
+
+depth_index::depth_index(depth_index_config cfg) : cfg_(cfg) {
+    bid_.quantity.assign(cfg_.ticks, 0.0);
+    bid_.notional.assign(cfg_.ticks, 0.0);
+    ask_.quantity.assign(cfg_.ticks, 0.0);
+    ask_.notional.assign(cfg_.ticks, 0.0);
+}
+
+depth_index::~depth_index() {
+    if (pending_.valid()) pending_.wait();   // 后台线程可能还在写备用树
+}
+
+int64_t depth_index::position_in(const depth_index_config& cfg, int64_t low_tick, book_side side, double price) {
+    const int64_t tick = std::llround(price / cfg.tick);
+    const int64_t high_tick = low_tick + static_cast<int64_t>(cfg.ticks) - 1;
+    return side == book_side::bid ? high_tick - tick : tick - low_tick;
+}
+
+int64_t depth_index::position(book_side side, double price) const {
+    return position_in(cfg_, low_tick_, side, price);
+}
+
+double depth_index::price_at(book_side side, int64_t pos) const {
+    const int64_t high_tick = low_tick_ + static_cast<int64_t>(cfg_.ticks) - 1;
+    return static_cast<double>(side == book_side::bid ? high_tick - pos : low_tick_ + pos) * cfg_.tick;
+}
+
+bool depth_index::covers(double price) const {
+    const int64_t pos = position(book_side::ask, price);
+    return built_ && pos >= 0 && pos < static_cast<int64_t>(cfg_.ticks);
+}
+
+void depth_index::on_level_changed(book_side side, double price, double delta) {
+    if (!built_ || delta == 0.0) return;
+    if (pending_.valid()) pending_deltas_.push_back({side, price, delta});
+    add(side, price, delta);
+}
+
+void depth_index::add(book_side side, double price, double delta) {
+    const int64_t pos = position(side, price);
+    if (pos < 0 || pos >= static_cast<int64_t>(cfg_.ticks)) return;
+
+    side_tree& tree = side == book_side::bid ? bid_ : ask_;
+    fenwick_add(tree.quantity, static_cast<std::size_t>(pos), delta);
+    fenwick_add(tree.notional, static_cast<std::size_t>(pos), delta * price);
+}
+
+bool depth_index::off_center(double best_bid, double best_ask) const {
+    if (best_bid <= 0.0 && best_ask <= 0.0) return false;
+    if (!built_) return true;
+
+    // 最优价都要留在窗口中间一半里
+    const int64_t quarter = static_cast<int64_t>(cfg_.ticks / 4);
+    const int64_t lo = low_tick_ + quarter;
+    const int64_t hi = low_tick_ + static_cast<int64_t>(cfg_.ticks) - quarter;
+    for (double price : {best_bid, best_ask}) {
+        if (price <= 0.0) continue;
+        const int64_t tick = std::llround(price / cfg_.tick);
+        if (tick < lo || tick > hi) return true;
+    }
+    return false;
+}
+
+bool depth_index::center(const consolidated_bid_book& bids, const consolidated_ask_book& asks,
+                         int64_t& low_tick) const {
+    double mid = 0.0;
+    if (!bids.empty() && !asks.empty()) mid = (bids.begin()->first + asks.begin()->first) / 2;
+    else if (!bids.empty()) mid = bids.begin()->first;
+    else if (!asks.empty()) mid = asks.begin()->first;
+    else return false;
+
+    low_tick = std::llround(mid / cfg_.tick) - static_cast<int64_t>(cfg_.ticks / 2);
+    return true;
+}
+
+void depth_index::build_tree(const depth_index_config& cfg, int64_t low_tick, side_tree& tree, book_side side,
+                             const level_list& levels) {
+    tree.quantity.assign(cfg.ticks, 0.0);
+    tree.notional.assign(cfg.ticks, 0.0);
+    for (const auto& [price, qty] : levels) {
+        const int64_t pos = position_in(cfg, low_tick, side, price);
+        if (pos < 0 || pos >= static_cast<int64_t>(cfg.ticks)) continue;
+        tree.quantity[pos] += qty;
+        tree.notional[pos] += qty * price;
+    }
+    fenwick_build(tree.quantity);
+    fenwick_build(tree.notional);
+}
+
+void depth_index::rebuild(const consolidated_bid_book& bids, const consolidated_ask_book& asks) {
+    int64_t low_tick;
+    if (!center(bids, asks, low_tick)) return;
+
+    // 还在建的后台结果已经过时，等它结束后把树留作备用
+    if (pending_.valid()) {
+        spare_ = pending_.get();
+        pending_deltas_.clear();
+    }
+
+    low_tick_ = low_tick;
+    built_ = true;
+    ++rebuilds_;
+    auto pos = [&](book_side side) { return [&, side](double p) { return position_in(cfg_, low_tick, side, p); }; };
+    build_tree(cfg_, low_tick, bid_, book_side::bid, window_levels(bids, cfg_.ticks, pos(book_side::bid)));
+    build_tree(cfg_, low_tick, ask_, book_side::ask, window_levels(asks, cfg_.ticks, pos(book_side::ask)));
+}
+
+void depth_index::begin_rebuild(const consolidated_bid_book& bids, const consolidated_ask_book& asks) {
+    int64_t low_tick;
+    if (pending_.valid() || !center(bids, asks, low_tick)) return;
+
+    auto pos = [&](book_side side) { return [&, side](double p) { return position_in(cfg_, low_tick, side, p); }; };
+    level_list bid_levels = window_levels(bids, cfg_.ticks, pos(book_side::bid));
+    level_list ask_levels = window_levels(asks, cfg_.ticks, pos(book_side::ask));
+    pending_low_tick_ = low_tick;
+    pending_deltas_.clear();
+
+    // 窗口移位很少发生（中间价要走出窗口的四分之一），每次起一个线程即可
+    pending_ = std::async(std::launch::async,
+                          [cfg = cfg_, low_tick, t = std::move(spare_), bid_levels = std::move(bid_levels),
+                           ask_levels = std::move(ask_levels)]() mutable {
+                              build_tree(cfg, low_tick, t.bid, book_side::bid, bid_levels);
+                              build_tree(cfg, low_tick, t.ask, book_side::ask, ask_levels);
+                              return std::move(t);
+                          });
+}
+
+bool depth_index::poll_rebuild() {
+    if (!pending_.valid() || pending_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+
+    trees t = pending_.get();
+    std::swap(bid_, t.bid);
+    std::swap(ask_, t.ask);
+    spare_ = std::move(t);
+    low_tick_ = pending_low_tick_;
+    ++rebuilds_;
+
+    // 拷贝档位之后的变化已经加在旧树上，新树上补一遍
+    for (const auto& d : pending_deltas_) add(d.side, d.price, d.delta);
+    pending_deltas_.clear();
+    return true;
+}
+
+depth_point depth_index::point_at(book_side side, int64_t pos) const {
+    depth_point p;
+    if (!built_ || pos < 0) return p;
+    if (pos >= static_cast<int64_t>(cfg_.ticks)) {
+        pos = static_cast<int64_t>(cfg_.ticks) - 1;
+        p.past_window = true;
+    }
+    const side_tree& tree = side == book_side::bid ? bid_ : ask_;
+    p.quantity = fenwick_prefix(tree.quantity, static_cast<std::size_t>(pos));
+    p.notional = fenwick_prefix(tree.notional, static_cast<std::size_t>(pos));
+    return p;
+}
+
+depth_point depth_index::to_price(book_side side, double price) const {
+    depth_point p = built_ ? point_at(side, position(side, price)) : depth_point{};
+    p.price = price;
+    return p;
+}
+
+depth_point depth_index::search(book_side side, bool by_notional, double threshold) const {
+    if (!built_ || threshold <= 0.0) return {};
+
+    const side_tree& tree = side == book_side::bid ? bid_ : ask_;
+    const std::size_t pos = fenwick_search(by_notional ? tree.notional : tree.quantity, threshold);
+    if (pos >= cfg_.ticks) {
+        depth_point p = point_at(side, static_cast<int64_t>(cfg_.ticks) - 1);
+        p.reached = false;
+        p.past_window = true;
+        return p;
+    }
+    depth_point p = point_at(side, static_cast<int64_t>(pos));
+    p.price = price_at(side, static_cast<int64_t>(pos));
+    return p;
+}
+
+depth_point depth_index::to_quantity(book_side side, double quantity) const {
+    return search(side, false, quantity);
+}
+
+depth_point depth_index::to_notional(book_side side, double notional) const {
+    return search(side, true, notional);
+}
@@ -0,0 +1,38 @@
+#include "handler_memory.h"
+#include <new>
+
+handler_memory::~handler_memory() {
+    for (void* p : blocks_) ::operator delete(p);
+}
+
+void* handler_memory::allocate(std::size_t bytes) {
+    if (bytes > MAX_POOLED) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++upstream_allocations_;
+        return ::operator new(bytes);
+    }
+    std::size_t cls = bytes == 0 ? 1 : (bytes + GRANULE - 1) / GRANULE;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_node* n = free_[cls - 1]) {
+        free_[cls - 1] = n->next;
+        return n;
+    }
+    ++upstream_allocations_;
+    void* p = ::operator new(cls * GRANULE);
+    blocks_.push_back(p);
+    return p;
+}
+
+void handler_memory::deallocate(void* p, std::size_t bytes) {
+    if (bytes > MAX_POOLED) {
+        ::operator delete(p);
+        return;
+    }
+    std::size_t cls = bytes == 0 ? 1 : (bytes + GRANULE - 1) / GRANULE;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* n = static_cast<free_node*>(p);
+    n->next = free_[cls - 1];
+    free_[cls - 1] = n;
+}
@@ -0,0 +1,41 @@
+#include "line_arbiter.h"
+#include <algorithm>
+
+line_arbiter::line_arbiter(std::size_t lines) : stats_(std::max<std::size_t>(1, lines)) {}
+
+void line_arbiter::reset() {
+    history_.fill(arrival{});
+    last_seq_ = 0;
+    stale_run_ = 0;
+}
+
+bool line_arbiter::accept(std::size_t line, uint64_t seq, int64_t now_ns) {
+    ++stats_[line].messages;
+
+    if (seq > last_seq_ || stale_run_ + 1 >= STALE_RESET) {
+        last_seq_ = seq;
+        history_[seq % HISTORY] = {seq, now_ns, line};
+        stale_run_ = 0;
+        ++stats_[line].wins;
+        return true;
+    }
+
+    ++stats_[line].duplicates;
+
+    const arrival& first = history_[seq % HISTORY];
+    if (first.seq != seq) {
+        // 太旧（超出历史）或交易所重置了序列号
+        ++stale_run_;
+        return false;
+    }
+
+    stale_run_ = 0;
+    if (first.line != line) {
+        auto lead = static_cast<uint64_t>(std::max<int64_t>(0, now_ns - first.ns));
+        line_stats& winner = stats_[first.line];
+        winner.lead_ns_total += lead;
+        ++winner.lead_samples;
+        winner.max_lead_ns = std::max(winner.max_lead_ns, lead);
+    }
+    return false;
+}
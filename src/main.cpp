@@ -1,4 +1,9 @@
 #include <boost/asio/io_context.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
 #include "Aggregator.h"
 
 int main(int argc, char** argv) {
@@ -7,9 +12,38 @@ int main(int argc, char** argv) {
         config_file = argv[1];
     }
 
+    // 订单簿内存池以大页为上游（需要系统预留 hugepages，否则退回普通页）
+    const char* huge_pages = std::getenv("AGGREGATOR_HUGE_PAGES");
+    if (huge_pages && std::strcmp(huge_pages, "1") == 0) {
+        book_memory::use_huge_pages(true);
+    }
+
+    std::cout << "[main] asio reactor: " << io_backend_name() << std::endl;
+
     boost::asio::io_context ioc;
     Aggregator agg(ioc);
     agg.start(config_file);
-    ioc.run();
+
+    const auto& rt = agg.runtime();
+    auto pin_io_thread = [&rt](int index) {
+        if (!rt.io_cores.empty()) {
+            pin_current_thread({rt.io_cores[index % rt.io_cores.size()]}, "io");
+        } else if (rt.io_core >= 0 && index == 0) {
+            pin_current_thread({rt.io_core}, "io");
+        }
+    };
+
+    // 多个线程跑同一个 io_context：连接器之间并行，各自的回调由自己的 strand 串行
+    std::vector<std::thread> io_threads;
+    for (int i = 1; i < rt.io_threads; ++i) {
+        io_threads.emplace_back([&ioc, &rt, pin_io_thread, i] {
+            pin_io_thread(i);
+            run_io_loop(ioc, rt.busy_poll);
+        });
+    }
+
+    pin_io_thread(0);
+    run_io_loop(ioc, rt.busy_poll);
+    for (auto& t : io_threads) t.join();
     return 0;
 }
@@ -1,8 +1,31 @@
 #include "market_connector.h"
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <sys/socket.h>
+#include <time.h>
+#include <openssl/bio.h>
 #include "Aggregator.h"  // For Aggregator*
+#include "alloc_profile.h"
 using namespace std;
 
+namespace {
+
+constexpr uint64_t STATS_LOG_EVERY = 10000;  // 每 N 条消息打印一次流量统计
+
+uint64_t thread_cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+int connector_ex_index() {
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+}  // namespace
+
 market_connector::market_connector(net::io_context& ioc, Aggregator* aggregator, std::string name,
                                    std::string host, std::string port, std::string path, event_callback cb)
     : ioc_(ioc),
@@ -12,12 +35,17 @@ market_connector::market_connector(net::io_context& ioc, Aggregator* aggregator,
       port_(std::move(port)),
       path_(std::move(path)),
       callback_(std::move(cb)),
-      resolver_(ioc),
+      strand_(net::make_strand(ioc)),
+      resolver_(strand_),
       ssl_ctx_(ssl::context::tls_client),
-      ws_(ioc, ssl_ctx_),
-      ping_timer_(ioc),
-      reconnect_timer_(ioc),
-      handshake_timer_(ioc)
+      ws_(std::make_unique<ws_stream>(strand_, ssl_ctx_)),
+      local_bids_(book_mem_.resource()),
+      local_asks_(book_mem_.resource()),
+      prev_bids_(book_mem_.resource()),
+      prev_asks_(book_mem_.resource()),
+      ping_timer_(strand_),
+      reconnect_timer_(strand_),
+      handshake_timer_(strand_)
 {
     std::cout << "[" << name_ << "] Initializing connector..." << std::endl;
     ssl_ctx_.set_options(
@@ -35,9 +63,27 @@ market_connector::market_connector(net::io_context& ioc, Aggregator* aggregator,
     
     ssl_ctx_.set_verify_mode(ssl::verify_peer);
 
+    // 客户端会话缓存交给我们自己保存（TLS 1.3 的 ticket 在握手之后才到，只能走回调）
+    // app data 槽位被 asio 的 verify 回调占用，这里另申请一个 ex_data 槽位
+    SSL_CTX_set_ex_data(ssl_ctx_.native_handle(), connector_ex_index(), this);
+    SSL_CTX_set_session_cache_mode(ssl_ctx_.native_handle(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx_.native_handle(), &market_connector::on_new_tls_session);
+
     std::cout << "[" << name_ << "] SSL context configured (verify_peer + level 1)" << std::endl;
 }
 
+market_connector::~market_connector() {
+    if (tls_session_) SSL_SESSION_free(tls_session_);
+}
+
+int market_connector::on_new_tls_session(SSL* ssl, SSL_SESSION* session) {
+    auto* self = static_cast<market_connector*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), connector_ex_index()));
+    if (!self) return 0;
+    if (self->tls_session_) SSL_SESSION_free(self->tls_session_);
+    self->tls_session_ = session;
+    return 1;  // 接管引用计数
+}
+
 void market_connector::start() {
     std::cout << "[" << name_ << "] Starting connection to " << host_ << ":" << port_ << std::endl;
     
@@ -49,20 +95,28 @@ void market_connector::start() {
     reconnect_timer_.cancel(ignore_ec);
     ping_timer_.cancel(ignore_ec);
     buffer_.consume(buffer_.size());
+
+    // 重连时换一个全新的 stream；旧的留到下次重连，保证它的回调都已经结束
+    if (retry_count_ > 0) {
+        retired_ws_ = std::move(ws_);
+        ws_ = std::make_unique<ws_stream>(strand_, ssl_ctx_);
+    }
     
     std::cout << "[" << name_ << "] Reset all WS state, buffer and timers" << std::endl;
-    
-    // 优雅关闭旧连接（异步）
-    // ws_.async_close(websocket::close_code::normal, [](beast::error_code){});
-    // std::cout<<"ws asyn close"<<std::endl;
+
+    if (!endpoints_.empty()) {
+        // 复用上次解析结果，省掉一次 DNS 往返
+        std::cout << "[" << name_ << "] Using cached DNS result" << std::endl;
+        do_connect();
+        return;
+    }
+
     auto self = shared_from_this();
     resolver_.async_resolve(host_, port_,
         [self](beast::error_code ec, tcp::resolver::results_type results) {
             self->on_resolve(ec, results);
         });
     cout<<"resolve"<<endl;
-    
-    // retry_count_ = 0;
 }
 
 void market_connector::fail(const boost::system::error_code& ec, const char* what) {
@@ -80,12 +134,22 @@ void market_connector::fail(const boost::system::error_code& ec, const char* wha
     handshake_timer_.cancel(ignore_ec);
     ping_timer_.cancel(ignore_ec);
 
-    // ❌ 不再同步 close socket / ws_
-    // ✅ 让 Beast 自己通过错误传播关闭
-
     buffer_.consume(buffer_.size());
 
-    bool should_reconnect =
+    // 旧 stream 不再复用（start() 会换新的），直接关 socket，让挂着的读写尽快以错误结束
+    beast::get_lowest_layer(*ws_).socket().close(ignore_ec);
+
+    if (!awaiting_first_book_) {
+        disconnected_at_ = std::chrono::steady_clock::now();
+        awaiting_first_book_ = true;
+    }
+
+    // 连接阶段失败时缓存的地址可能已经失效，下次重新解析
+    if (std::strcmp(what, "connect") == 0 || std::strcmp(what, "resolve") == 0) {
+        endpoints_ = {};
+    }
+
+    bool transient =
         ec == net::error::connection_reset ||
         ec == net::error::connection_aborted ||
         ec == net::error::eof ||
@@ -94,34 +158,26 @@ void market_connector::fail(const boost::system::error_code& ec, const char* wha
         ec == websocket::error::closed ||
         ec.category() == net::ssl::error::get_stream_category();
 
-    if (!should_reconnect) {
-        std::cerr << "[" << name_ << "] Fatal error, no reconnect: " << ec.message() << "\n";
-        return;
-    }
-
-    constexpr int MAX_RETRY = 10;
+    // 不设重试上限：断线是常态，第一次几乎立即重连，之后指数退避到 MAX_BACKOFF_MS
+    // 非瞬时错误（DNS 失败、握手被拒等）从 1 秒起退避
     constexpr int MAX_BACKOFF_MS = 30000;
-    constexpr int INITIAL_BACKOFF_MS = 1000;
+    constexpr int FIRST_BACKOFF_MS = 20;
+    constexpr int NON_TRANSIENT_BACKOFF_MS = 1000;
     constexpr double BACKOFF_MULTIPLIER = 2.0;
 
     retry_count_++;
-    if (retry_count_ > MAX_RETRY) {
-        std::cerr << "[" << name_ << "] Max retries reached, stopping reconnect.\n";
-        return;
-    }
-
-    int backoff_ms = std::min(
-        static_cast<int>(INITIAL_BACKOFF_MS * std::pow(BACKOFF_MULTIPLIER, retry_count_ - 1)),
-        MAX_BACKOFF_MS
-    );
+    int initial_ms = transient ? FIRST_BACKOFF_MS : NON_TRANSIENT_BACKOFF_MS;
+    int backoff_ms = static_cast<int>(std::min<double>(
+        initial_ms * std::pow(BACKOFF_MULTIPLIER, std::min(retry_count_ - 1, 20)),
+        MAX_BACKOFF_MS));
 
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_real_distribution<> dis(0.8, 1.2);
     backoff_ms = static_cast<int>(backoff_ms * dis(gen));
 
-    std::cout << "[" << name_ << "] Reconnecting in " << backoff_ms / 1000.0
-              << " seconds... (attempt " << retry_count_ << "/" << MAX_RETRY << ")\n";
+    std::cout << "[" << name_ << "] Reconnecting in " << backoff_ms << " ms... (attempt "
+              << retry_count_ << (transient ? "" : ", non-transient error") << ")\n";
 
     auto self = shared_from_this();
     reconnect_timer_.expires_after(std::chrono::milliseconds(backoff_ms));
@@ -137,9 +193,13 @@ void market_connector::on_resolve(beast::error_code ec,
     if (ec) return fail(ec, "resolve");
 
     std::cout << "[" << name_ << "] DNS resolved successfully, req connect TCP" << std::endl;
-    
-    beast::get_lowest_layer(ws_).async_connect(
-        results,
+    endpoints_ = results;
+    do_connect();
+}
+
+void market_connector::do_connect() {
+    beast::get_lowest_layer(*ws_).async_connect(
+        endpoints_,
         beast::bind_front_handler(&market_connector::on_connect, this));
 }
 
@@ -149,14 +209,28 @@ void market_connector::on_connect(beast::error_code ec,
 
     std::cout << "[" << name_ << "] TCP connected to " << ep << std::endl;
 
-    if(!SSL_set_tlsext_host_name(ws_.next_layer().native_handle(), host_.c_str()))
+    if (socket_busy_poll_us_ > 0) {
+        // 内核在 recv 时忙轮询网卡队列，省掉中断 + 唤醒延迟（超过 net.core.busy_read 需要 CAP_NET_ADMIN）
+        int fd = beast::get_lowest_layer(*ws_).socket().native_handle();
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &socket_busy_poll_us_, sizeof(socket_busy_poll_us_)) != 0) {
+            std::cerr << "[" << name_ << "] SO_BUSY_POLL failed: " << strerror(errno) << std::endl;
+        }
+    }
+
+    // 内核接收时间戳：把网络 / 内核延迟和本进程的处理延迟分开
+    enable_rx_timestamps(beast::get_lowest_layer(*ws_).socket().native_handle());
+
+    // 带上上次的会话，服务端接受时省掉证书交换和一次密钥协商
+    if (tls_session_) SSL_set_session(ws_->next_layer().native_handle(), tls_session_);
+
+    if(!SSL_set_tlsext_host_name(ws_->next_layer().native_handle(), host_.c_str()))
     {
         ec = beast::error_code(static_cast<int>(::ERR_get_error()), net::error::get_ssl_category());
         return fail(ec, "set_tlsext_host_name");
     } 
     //above if deleted by grok, lead to bitget/OKX error                               
     std::cout << "[" << name_ << "] Starting SSL handshake..." << std::endl;
-    ws_.next_layer().async_handshake(
+    ws_->next_layer().async_handshake(
         ssl::stream_base::client,
         beast::bind_front_handler(&market_connector::on_ssl_handshake, this));
 }
@@ -164,7 +238,9 @@ void market_connector::on_connect(beast::error_code ec,
 void market_connector::on_ssl_handshake(beast::error_code ec) {
     if (ec) return fail(ec, "ssl_handshake");
 
-    std::cout << "[" << name_ << "] SSL handshake success" << std::endl;
+    bool resumed = SSL_session_reused(ws_->next_layer().native_handle());
+    if (resumed) ++stats_.tls_resumed;
+    std::cout << "[" << name_ << "] SSL handshake success" << (resumed ? " (session resumed)" : "") << std::endl;
 
     auto self = shared_from_this();
 
@@ -176,7 +252,12 @@ void market_connector::on_ssl_handshake(beast::error_code ec) {
         }
     });
 
-    ws_.async_handshake(host_, path_,
+    // 必须在握手前设置；握手请求里带 Sec-WebSocket-Extensions: permessage-deflate
+    websocket::permessage_deflate pmd;
+    pmd.client_enable = compression_;
+    ws_->set_option(pmd);
+
+    ws_->async_handshake(handshake_res_, host_, path_,
         beast::bind_front_handler(&market_connector::on_ws_handshake, self));
 
 }
@@ -192,10 +273,19 @@ void market_connector::on_ws_handshake(beast::error_code ec) {
 
     std::cout << "[" << name_ << "] WebSocket handshake success" << std::endl;
 
+    if (compression_) {
+        auto ext = handshake_res_[http::field::sec_websocket_extensions];
+        compression_active_ = ext.find("permessage-deflate") != beast::string_view::npos;
+        std::cout << "[" << name_ << "] permessage-deflate "
+                  << (compression_active_ ? "negotiated" : "not accepted by server") << std::endl;
+    }
+    // 握手字节不计入流量统计
+    wire_bytes_mark_ = BIO_number_read(SSL_get_rbio(ws_->next_layer().native_handle()));
+
     auto msg = subscription_message();
     if (!msg.empty()) {
         std::cout << "[" << name_ << "] Sending subscription message: " << msg << std::endl;
-        ws_.async_write(net::buffer(msg),
+        ws_->async_write(net::buffer(msg),
             beast::bind_front_handler(&market_connector::on_write, this));  // 修复: 替换 ...
     } else {
         std::cout << "[" << name_ << "] No subscription message needed, starting read..." << std::endl;
@@ -216,8 +306,11 @@ void market_connector::on_write(beast::error_code ec, std::size_t bytes_transfer
 
 void market_connector::do_read() {
     // std::cout << "[" << name_ << "] Starting async read..." << std::endl;
-    ws_.async_read(buffer_,
-        beast::bind_front_handler(&market_connector::on_read, this));
+    read_cpu_mark_ = thread_cpu_ns();
+    read_thread_ = std::this_thread::get_id();
+    alloc_scope scope(alloc_stage::read);   // 发起时 beast 可能就扩 buffer_ 或处理已缓冲的帧
+    ws_->async_read(buffer_,
+        recycle(handler_mem_, beast::bind_front_handler(&market_connector::on_read, this)));
 }
 
 void market_connector::on_read(beast::error_code ec, std::size_t bytes_transferred) {
@@ -235,6 +328,16 @@ void market_connector::on_read(beast::error_code ec, std::size_t bytes_transferr
     
     if (ec) return fail(ec, "read");
 
+    alloc_scope scope(alloc_stage::read);
+    update_read_stats(bytes_transferred);
+    const int64_t rx_ns = ws_->next_layer().next_layer().last_rx_ns();
+    if (rx_ns > 0) {
+        uint64_t delay = static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() - rx_ns));
+        stats_.rx_delay_ns += delay;
+        stats_.max_rx_delay_ns = std::max(stats_.max_rx_delay_ns, delay);
+    }
+
     std::string msg = beast::buffers_to_string(buffer_.data());
     buffer_.consume(buffer_.size());
 
@@ -249,67 +352,154 @@ void market_connector::on_read(beast::error_code ec, std::size_t bytes_transferr
         return;
     }
 
-    handle_message(msg);
+    if (primary_) {
+        // 备线不解析，收到第一条带序列号的消息就算恢复；消息交到主线路的 strand 上去重、解析
+        if (awaiting_first_book_ && sequence_id(msg) != 0) note_first_book();
+        net::post(primary_->strand_, recycle(handler_mem_,
+            [primary = primary_->shared_from_this(), line = line_, msg = std::move(msg), rx_ns] {
+                primary->deliver_timed(line, msg, rx_ns);
+            }));
+    } else {
+        deliver_timed(0, msg, rx_ns);
+    }
     do_read();
 }
 
+void market_connector::deliver_timed(std::size_t line, const std::string& msg, int64_t rx_ns) {
+    alloc_scope scope(alloc_stage::parse);
+    msg_rx_ns_ = rx_ns;
+    uint64_t parse_start = thread_cpu_ns();
+    deliver(line, msg);
+    stats_.parse_cpu_ns += thread_cpu_ns() - parse_start;
+}
+
+void market_connector::note_first_book() {
+    awaiting_first_book_ = false;
+    retry_count_ = 0;
+    ++stats_.reconnects;
+    stats_.last_gap_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - disconnected_at_).count();
+    stats_.max_gap_ms = std::max(stats_.max_gap_ms, stats_.last_gap_ms);
+    std::cout << "[" << name_ << "] First book " << stats_.last_gap_ms << " ms after disconnect (max "
+              << stats_.max_gap_ms << " ms, " << stats_.tls_resumed << " TLS resumptions)" << std::endl;
+}
+
+bool market_connector::accept_line(std::size_t line, uint64_t seq, bool reset) {
+    // 没有序列号的消息（成交、订阅确认等）任何线路都收：成交在 add_trade 里按成交号去重，其余不改簿
+    if (seq == 0) return true;
+    if (reset) arbiter_.reset();
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return arbiter_.accept(line, seq, now);
+}
+
+uint64_t market_connector::find_uint_field(const std::string& msg, const char* key) {
+    const std::size_t len = std::strlen(key);
+    for (std::size_t pos = msg.find(key, 0, len); pos != std::string::npos; pos = msg.find(key, pos + len, len)) {
+        // 必须是完整的 "key"，而不是别的字段名的一部分
+        if (pos == 0 || msg[pos - 1] != '"' || pos + len >= msg.size() || msg[pos + len] != '"') continue;
+
+        std::size_t i = pos + len + 1;
+        while (i < msg.size() && (msg[i] == ':' || msg[i] == ' ' || msg[i] == '"')) ++i;
+
+        uint64_t value = 0;
+        bool any = false;
+        for (; i < msg.size() && msg[i] >= '0' && msg[i] <= '9'; ++i) {
+            value = value * 10 + static_cast<uint64_t>(msg[i] - '0');
+            any = true;
+        }
+        if (any) return value;
+    }
+    return 0;
+}
+
+void market_connector::update_read_stats(std::size_t bytes_transferred) {
+    // io_threads > 1 时回调可能换了线程，CLOCK_THREAD_CPUTIME_ID 只能和同一线程的读数相减
+    if (read_thread_ == std::this_thread::get_id()) {
+        stats_.read_cpu_ns += thread_cpu_ns() - read_cpu_mark_;
+        ++stats_.read_cpu_samples;
+    }
+    stats_.payload_bytes += bytes_transferred;
+    ++stats_.messages;
+
+    // SSL 的 rbio 累计了从 socket 读进来的密文字节
+    uint64_t wire = BIO_number_read(SSL_get_rbio(ws_->next_layer().native_handle()));
+    stats_.wire_bytes += wire - wire_bytes_mark_;
+    wire_bytes_mark_ = wire;
+
+    if (stats_.messages - stats_logged_at_ < STATS_LOG_EVERY) return;
+    stats_logged_at_ = stats_.messages;
+    std::cout << "[" << name_ << (primary_ ? " line " + std::to_string(line_) : std::string())
+              << "] " << stats_.messages << " msgs, wire " << stats_.wire_bytes
+              << " B, payload " << stats_.payload_bytes << " B (ratio "
+              << static_cast<double>(stats_.wire_bytes) / std::max<uint64_t>(1, stats_.payload_bytes)
+              << "), read cpu " << stats_.read_cpu_ns / std::max<uint64_t>(1, stats_.read_cpu_samples)
+              << " ns/msg, parse cpu " << stats_.parse_cpu_ns / stats_.messages << " ns/msg"
+              << (compression_active_ ? " [deflate]" : "") << std::endl;
+
+    for (std::size_t i = 0; arbiter_.lines() > 1 && i < arbiter_.lines(); ++i) {
+        const line_stats& ls = arbiter_.stats(i);
+        std::cout << "[" << name_ << "] line " << i << ": " << ls.wins << " first, " << ls.duplicates
+                  << " duplicate, avg lead " << (ls.lead_samples ? ls.lead_ns_total / ls.lead_samples / 1000 : 0)
+                  << " us, max lead " << ls.max_lead_ns / 1000 << " us" << std::endl;
+    }
+}
+
 void market_connector::do_ping() {
   if (stopped_) return;
 
   ping_timer_.expires_after(std::chrono::seconds(17));
-  ping_timer_.async_wait([this](beast::error_code ec) {
+  ping_timer_.async_wait(recycle(handler_mem_, [this](beast::error_code ec) {
     if (stopped_ || ec) {
         std::cout << "[" << name_ << "] Ping timer canceled or stopped" << std::endl;
-        ws_.async_close(websocket::close_code::normal, [](beast::error_code){});
+        ws_->async_close(websocket::close_code::normal, [](beast::error_code){});
         return;
     }
     
-    std::string ping_payload;
-
-    if (name_ == "Binance") {
+    if (ping_ == ping_kind::ws_ping) {
         // std::cout << "[" << name_ << "] Sending WebSocket ping..." << std::endl;
         // Binance 使用 WebSocket ping (空 payload 即可)
-        ws_.async_ping(websocket::ping_data("keep-alive"), [this](beast::error_code ping_ec) {
+        ws_->async_ping(websocket::ping_data("keep-alive"), recycle(handler_mem_, [this](beast::error_code ping_ec) {
             if (ping_ec) fail(ping_ec, "ping");
             else {
                 std::cout << "[" << name_ << "] WebSocket ping sent" << std::endl;
                 do_ping();
             }
-        });
+        }));
         return;
-    } else if (name_ == "OKX" || name_ == "Bybit") {
-        // OKX / Bitget 使用 JSON ping
-        ws_.text(true);
-        ping_payload = R"({"op": "ping"})";
-        ws_.async_write(net::buffer(ping_payload), [this](beast::error_code write_ec, std::size_t) {
+    } else if (ping_ == ping_kind::json_op) {
+        // OKX / Bybit 使用 JSON ping；payload 放在成员里，异步写完成前必须有效
+        ws_->text(true);
+        ping_payload_ = R"({"op": "ping"})";
+        ws_->async_write(net::buffer(ping_payload_), recycle(handler_mem_, [this](beast::error_code write_ec, std::size_t) {
             if (write_ec) {
                 fail(write_ec, "json ping write");
             } else {
                 std::cout << "[" << name_ << "] Sent JSON ping" << std::endl;
                 do_ping();
             }
-        });
+        }));
         return;
     }  
-    else if (name_ == "Bitget") {
+    else if (ping_ == ping_kind::json_op_ts) {
         auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
                         std::chrono::system_clock::now().time_since_epoch())
                         .count();
 
-        std::string ping_payload = R"({"op":"ping","ts":)" + std::to_string(now_ms) + "}";
+        ping_payload_ = R"({"op":"ping","ts":)" + std::to_string(now_ms) + "}";
 
         // 设置为文本模式
-        ws_.text(true); 
+        ws_->text(true); 
 
-        ws_.async_write(net::buffer(ping_payload),
-            [this](beast::error_code write_ec, std::size_t) {
+        ws_->async_write(net::buffer(ping_payload_),
+            recycle(handler_mem_, [this](beast::error_code write_ec, std::size_t) {
             if (write_ec) {
                 fail(write_ec, "json ping write");
             } else {
                 std::cout << "[" << name_ << "] Sent JSON ping" << std::endl;
                 do_ping();
             }
-        });
+        }));
         return;
     }
 
@@ -318,13 +508,117 @@ void market_connector::do_ping() {
     do_ping();
 
 
-  });
+  }));
+}
+
+void market_connector::finish_message() {
+  if (in_snapshot_) abort_snapshot();  // 解析中途抛异常：半个快照不提交，否则没解析到的档位都会被当成删除
+
+  // 重连后第一份完整的簿：断线代价到此结束
+  if (awaiting_first_book_ && !local_bids_.empty() && !local_asks_.empty()) note_first_book();
+
+  if (!pending_trades_.empty()) {
+    if (aggregator_) aggregator_->on_trades(pending_trades_);
+    pending_trades_.clear();
+  }
+
+  if (pending_changes_.empty()) return;  // 订阅确认 / 无变化的快照不通知
+
+  // 本交易所的最优价随变化一起交出去，Aggregator 不用等合并簿就能算合并 BBO
+  top_of_book top;
+  if (!local_bids_.empty()) {
+    top.bid_price = local_bids_.begin()->first;
+    top.bid_qty = local_bids_.begin()->second;
+  }
+  if (!local_asks_.empty()) {
+    top.ask_price = local_asks_.begin()->first;
+    top.ask_qty = local_asks_.begin()->second;
+  }
+  if (aggregator_) aggregator_->on_book_updated(this, pending_changes_, top, msg_rx_ns_);  // 拷进交接环，缓冲区留给下一条
+  pending_changes_.clear();
+}
+
+namespace {
+
+template <class Book>
+void set_book_level(Book& book, const Book* prev, book_side side, double price, double qty,
+                    std::vector<level_change>& changes) {
+    if (prev) {
+        // 快照模式：新簿从空开始重建，只有与旧簿不同的价位才算变化
+        if (qty <= 0.0) return;
+        book[price] = qty;
+        auto old = prev->find(price);
+        if (old == prev->end() || old->second != qty) changes.push_back({side, price, qty});
+        return;
+    }
+
+    if (qty <= 0.0) {
+        if (book.erase(price)) changes.push_back({side, price, 0.0});
+        return;
+    }
+    auto [it, inserted] = book.try_emplace(price, qty);
+    if (!inserted) {
+        if (it->second == qty) return;
+        it->second = qty;
+    }
+    changes.push_back({side, price, qty});
+}
+
+template <class Book>
+void diff_removed(const Book& book, Book& prev, book_side side, std::vector<level_change>& changes) {
+    for (const auto& [price, qty] : prev) {
+        if (book.find(price) == book.end()) changes.push_back({side, price, 0.0});
+    }
+    prev.clear();
+}
+
+}  // namespace
+
+void market_connector::set_level(book_side side, double price, double qty) {
+    if (side == book_side::bid) {
+        set_book_level(local_bids_, in_snapshot_ ? &prev_bids_ : nullptr, side, price, qty, pending_changes_);
+    } else {
+        set_book_level(local_asks_, in_snapshot_ ? &prev_asks_ : nullptr, side, price, qty, pending_changes_);
+    }
+}
+
+void market_connector::add_trade(book_side aggressor, double price, double qty, int64_t exchange_ts_ms,
+                                 uint64_t trade_id) {
+    if (redundant() && trade_id != 0) {
+        if (std::find(recent_trade_ids_.begin(), recent_trade_ids_.end(), trade_id) != recent_trade_ids_.end()) return;
+        recent_trade_ids_[recent_trade_pos_++ % recent_trade_ids_.size()] = trade_id;
+    }
+    trade_print t;
+    t.price = price;
+    t.qty = qty;
+    t.exchange_ts_ms = exchange_ts_ms;
+    t.rx_ns = msg_rx_ns_;
+    t.trade_id = trade_id;
+    t.venue = static_cast<uint32_t>(venue_id_);
+    t.aggressor = aggressor;
+    pending_trades_.push_back(t);
+}
+
+void market_connector::begin_snapshot() {
+    if (in_snapshot_) abort_snapshot();
+    snapshot_changes_from_ = pending_changes_.size();
+    // 同一内存池的两本簿，swap 是 O(1)；prev_* 在上次 end_snapshot() 已清空
+    prev_bids_.swap(local_bids_);
+    prev_asks_.swap(local_asks_);
+    in_snapshot_ = true;
+}
+
+void market_connector::end_snapshot() {
+    diff_removed(local_bids_, prev_bids_, book_side::bid, pending_changes_);
+    diff_removed(local_asks_, prev_asks_, book_side::ask, pending_changes_);
+    in_snapshot_ = false;
 }
 
-void market_connector::handle_message(const std::string& msg) {
-//   std::cout << "[" << name_ << "] Received market update (length: " << msg.length() << " bytes)" << std::endl;
-  
-//   callback_(name_, msg);  // Keep printing raw
-  parse_message(msg);  // Parse and update book
-  if (aggregator_) aggregator_->on_book_updated(this);  // Notify
+void market_connector::abort_snapshot() {
+    local_bids_.swap(prev_bids_);
+    local_asks_.swap(prev_asks_);
+    prev_bids_.clear();
+    prev_asks_.clear();
+    pending_changes_.erase(pending_changes_.begin() + snapshot_changes_from_, pending_changes_.end());
+    in_snapshot_ = false;
 }
@@ -4,50 +4,40 @@
 
 using json = nlohmann::json;
 
-okx_connector::okx_connector(net::io_context& ioc, 
-                             Aggregator* aggregator, 
-                             std::string name, 
-                             std::string host, 
-                             std::string port, 
-                             std::string path, 
-                             event_callback cb)
-    : market_connector(ioc, aggregator, name, host, port, path, cb) {}                       
+template class venue_connector<okx_venue>;
 
-std::string okx_connector::subscription_message() const {
-    return R"({
-        "op":"subscribe",
-        "args":[{"channel":"books5","instId":"BTC-USDT"}]
-    })";
-}
-
-void okx_connector::handle_message(const std::string& msg) {
-    // callback_("OKX", msg);
-    market_connector::handle_message(msg);
-}
-
-void okx_connector::parse_message(const std::string& msg) {
+void okx_venue::parse(okx_connector& c, const std::string& msg) {
   try {
     json j = json::parse(msg);
     if (j.contains("event") && j["event"] == "subscribe") return;
 
-    if (j.contains("data")) {
+    if (j.contains("data") && j.contains("arg") && j["arg"].value("channel", "") == "trades") {
+      for (const auto& t : j["data"]) {
+        c.add_trade(t["side"] == "buy" ? book_side::bid : book_side::ask,
+                    std::stod(t["px"].get<std::string>()), std::stod(t["sz"].get<std::string>()),
+                    std::stoll(t["ts"].get<std::string>()), std::stoull(t["tradeId"].get<std::string>()));
+      }
+    } else if (j.contains("data")) {
       auto data = j["data"][0];
-      local_bids_.clear();
-      local_asks_.clear();
+      // books5 每条都是前 5 档全量
+      c.begin_snapshot();
 
       for (const auto& bid : data["bids"]) {
         double price = std::stod(bid[0].get<std::string>());
         double qty = std::stod(bid[1].get<std::string>());
-        local_bids_[price] = qty;
+        c.set_level(book_side::bid, price, qty);
       }
 
       for (const auto& ask : data["asks"]) {
         double price = std::stod(ask[0].get<std::string>());
         double qty = std::stod(ask[1].get<std::string>());
-        local_asks_[price] = qty;
+        c.set_level(book_side::ask, price, qty);
       }
+
+      c.end_snapshot();
     }
   } catch (const std::exception& e) {
-    std::cerr << "[" << name_ << "] Parse error: " << e.what() << std::endl;
+    c.note_parse_error();
+    std::cerr << "[" << c.name() << "] Parse error: " << e.what() << std::endl;
   }
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "order_book.h"
+#include <sys/mman.h>
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <vector>
+
+namespace {
+
+std::atomic<bool> g_use_huge_pages{false};
+
+constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// 池的上游：按 2MB 向内核申请，优先 MAP_HUGETLB，失败则退回普通页 + THP 提示
+// 池的 64KB chunk 从同一块 2MB 区域里顺序切出，用完再映射下一块，析构时整块归还；
+// 不小于 2MB 的请求单独映射
+class huge_page_resource : public std::pmr::memory_resource {
+public:
+    ~huge_page_resource() override {
+        for (void* r : regions_) munmap(r, HUGE_PAGE_SIZE);
+    }
+
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (bytes >= HUGE_PAGE_SIZE) return map(round_up(bytes));
+
+        std::size_t offset = (used_ + alignment - 1) & ~(alignment - 1);
+        if (regions_.empty() || offset + bytes > HUGE_PAGE_SIZE) {
+            regions_.push_back(map(HUGE_PAGE_SIZE));
+            offset = 0;
+        }
+        used_ = offset + bytes;
+        return static_cast<char*>(regions_.back()) + offset;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t) override {
+        // 切出来的小块随区域在析构时归还
+        if (bytes >= HUGE_PAGE_SIZE) munmap(p, round_up(bytes));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    static std::size_t round_up(std::size_t bytes) {
+        return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    }
+
+    static void* map(std::size_t len) {
+        void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) throw std::bad_alloc();
+            madvise(p, len, MADV_HUGEPAGE);
+        }
+        return p;
+    }
+
+    std::vector<void*> regions_;    // 切小块用的 2MB 区域，最后一块是当前区域
+    std::size_t used_ = 0;          // 当前区域已切出的字节
+};
+
+std::unique_ptr<std::pmr::memory_resource> make_upstream() {
+    if (!g_use_huge_pages.load(std::memory_order_relaxed)) return nullptr;
+    return std::make_unique<huge_page_resource>();
+}
+
+}  // namespace
+
+free_list_resource::free_list_resource(std::pmr::memory_resource* upstream)
+    : upstream_(upstream) {}
+
+free_list_resource::~free_list_resource() {
+    for (const auto& c : chunks_) {
+        upstream_->deallocate(c.ptr, c.bytes, alignof(std::max_align_t));
+    }
+}
+
+void* free_list_resource::do_allocate(std::size_t bytes, std::size_t alignment) {
+    if (bytes > MAX_POOLED || alignment > GRANULE) {
+        return upstream_->allocate(bytes, alignment);
+    }
+    std::size_t cls = (bytes + GRANULE - 1) / GRANULE;
+    if (cls == 0) cls = 1;
+    if (free_node* n = free_[cls - 1]) {
+        free_[cls - 1] = n->next;
+        return n;
+    }
+    std::size_t size = cls * GRANULE;
+    if (static_cast<std::size_t>(end_ - cursor_) < size) {
+        // 上一块剩余的尾巴直接丢弃（最多 MAX_POOLED 字节）
+        void* p = upstream_->allocate(CHUNK_BYTES, alignof(std::max_align_t));
+        chunks_.push_back({p, CHUNK_BYTES});
+        cursor_ = static_cast<char*>(p);
+        end_ = cursor_ + CHUNK_BYTES;
+    }
+    void* p = cursor_;
+    cursor_ += size;
+    return p;
+}
+
+void free_list_resource::do_deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+    if (bytes > MAX_POOLED || alignment > GRANULE) {
+        upstream_->deallocate(p, bytes, alignment);
+        return;
+    }
+    std::size_t cls = (bytes + GRANULE - 1) / GRANULE;
+    if (cls == 0) cls = 1;
+    auto* n = static_cast<free_node*>(p);
+    n->next = free_[cls - 1];
+    free_[cls - 1] = n;
+}
+
+bool free_list_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+book_memory::book_memory()
+    : upstream_(make_upstream()),
+      pool_(upstream_ ? upstream_.get() : std::pmr::new_delete_resource()) {}
+
+book_memory::~book_memory() = default;
+
+void book_memory::use_huge_pages(bool enable) {
+    g_use_huge_pages.store(enable, std::memory_order_relaxed);
+    std::cout << "[book_memory] Huge page upstream " << (enable ? "enabled" : "disabled") << std::endl;
+}
@@ -0,0 +1,120 @@
+#include "relay_client.h"
+#include <algorithm>
+#include <iostream>
+
+relay_config parse_relay_config(const nlohmann::json& j) {
+    relay_config cfg;
+    if (!j.is_object()) return cfg;
+
+    cfg.upstream = j.value("upstream", cfg.upstream);
+    cfg.trades = j.value("trades", cfg.trades);
+    cfg.max_backoff_ms = std::max(100, j.value("max_backoff_ms", cfg.max_backoff_ms));
+    return cfg;
+}
+
+relay_client::relay_client(relay_config cfg, book_callback on_book, trades_callback on_trades)
+    : cfg_(std::move(cfg)),
+      on_book_(std::move(on_book)),
+      on_trades_(std::move(on_trades)) {
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(-1);  // 全深度的 BookUpdate 可能超过默认的 4MB
+    channel_ = grpc::CreateCustomChannel(cfg_.upstream, grpc::InsecureChannelCredentials(), args);
+    stub_ = aggregator::AggregatorService::NewStub(channel_);
+}
+
+relay_client::~relay_client() { stop(); }
+
+bool relay_client::track(grpc::ClientContext* context) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) return false;
+    contexts_.push_back(context);
+    return true;
+}
+
+void relay_client::untrack(grpc::ClientContext* context) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    contexts_.erase(std::remove(contexts_.begin(), contexts_.end(), context), contexts_.end());
+}
+
+bool relay_client::wait_backoff(int& backoff_ms) {
+    backoff_ms = backoff_ms == 0 ? 100 : std::min(backoff_ms * 2, cfg_.max_backoff_ms);
+    std::unique_lock<std::mutex> lock(mutex_);
+    return !stop_cv_.wait_for(lock, std::chrono::milliseconds(backoff_ms), [this] { return stopped_; });
+}
+
+bool relay_client::fetch_book(aggregator::BookUpdate& out) {
+    aggregator::SubscribeRequest request;
+    request.set_with_venues(true);
+
+    int backoff_ms = 0;
+    while (true) {
+        grpc::ClientContext context;
+        if (!track(&context)) return false;
+        auto reader = stub_->SubscribeBook(&context, request);
+        bool ok = reader->Read(&out);
+        context.TryCancel();
+        reader->Finish();
+        untrack(&context);
+        if (ok) return true;
+
+        std::cerr << "[relay] Upstream " << cfg_.upstream << " not serving yet, retrying" << std::endl;
+        if (!wait_backoff(backoff_ms)) return false;
+    }
+}
+
+template <class Message, class Open, class Handle>
+void relay_client::run_stream(const char* what, Open open, Handle handle) {
+    int backoff_ms = 0;
+    while (true) {
+        grpc::ClientContext context;
+        if (!track(&context)) return;
+        auto reader = open(&context);
+
+        Message msg;
+        bool connected = false;
+        while (reader->Read(&msg)) {
+            if (!connected) {
+                std::cout << "[relay] " << what << " stream from " << cfg_.upstream << " connected" << std::endl;
+                connected = true;
+                backoff_ms = 0;
+            }
+            handle(msg);
+        }
+        grpc::Status status = reader->Finish();
+        untrack(&context);
+
+        std::cerr << "[relay] " << what << " stream ended: " << status.error_message() << std::endl;
+        if (!wait_backoff(backoff_ms)) return;
+    }
+}
+
+void relay_client::start() {
+    threads_.emplace_back([this] {
+        aggregator::SubscribeRequest request;
+        request.set_with_venues(true);
+        run_stream<aggregator::BookUpdate>("SubscribeBook",
+            [&](grpc::ClientContext* context) { return stub_->SubscribeBook(context, request); },
+            [this](aggregator::BookUpdate& update) { on_book_(update); });
+    });
+
+    if (!cfg_.trades) return;
+    threads_.emplace_back([this] {
+        aggregator::SubscribeRequest request;
+        run_stream<aggregator::TradeBatch>("SubscribeTrades",
+            [&](grpc::ClientContext* context) { return stub_->SubscribeTrades(context, request); },
+            [this](const aggregator::TradeBatch& batch) { on_trades_(batch); });
+    });
+}
+
+void relay_client::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+        for (auto* context : contexts_) context->TryCancel();
+    }
+    stop_cv_.notify_all();
+    for (auto& t : threads_) {
+        if (t.joinable()) t.join();
+    }
+    threads_.clear();
+}
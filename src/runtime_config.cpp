@@ -0,0 +1,79 @@
+#include "runtime_config.h"
+#include <boost/asio/executor_work_guard.hpp>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+runtime_config parse_runtime_config(const nlohmann::json& j) {
+    runtime_config cfg;
+    if (!j.is_object()) return cfg;
+
+    cfg.io_core = j.value("io_core", -1);
+    cfg.io_threads = std::max(1, j.value("io_threads", 1));
+    cfg.io_cores = j.value("io_cores", std::vector<int>{});
+    cfg.grpc_cores = j.value("grpc_cores", std::vector<int>{});
+    cfg.publisher_cores = j.value("publisher_cores", std::vector<int>{});
+    cfg.busy_poll = j.value("busy_poll", false);
+    cfg.socket_busy_poll_us = j.value("socket_busy_poll_us", 0);
+    cfg.stats_interval_ms = std::max(0, j.value("stats_interval_ms", 0));
+    cfg.grpc_port = j.value("grpc_port", cfg.grpc_port);
+    return cfg;
+}
+
+bool pin_current_thread(const std::vector<int>& cores, const char* who) {
+    if (cores.empty()) return true;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int core : cores) {
+        if (core >= 0 && core < CPU_SETSIZE) CPU_SET(core, &set);
+    }
+
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        std::cerr << "[runtime] Failed to pin " << who << " thread: " << strerror(rc) << std::endl;
+        return false;
+    }
+
+    std::cout << "[runtime] Pinned " << who << " thread to core(s)";
+    for (int core : cores) std::cout << " " << core;
+    std::cout << std::endl;
+    return true;
+}
+
+scoped_thread_affinity::scoped_thread_affinity() {
+    CPU_ZERO(&saved_);
+    valid_ = pthread_getaffinity_np(pthread_self(), sizeof(saved_), &saved_) == 0;
+}
+
+scoped_thread_affinity::~scoped_thread_affinity() {
+    if (!valid_) return;
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(saved_), &saved_);
+    if (rc != 0) std::cerr << "[runtime] Failed to restore thread affinity: " << strerror(rc) << std::endl;
+}
+
+void run_io_loop(boost::asio::io_context& ioc, bool busy_poll) {
+    if (!busy_poll) {
+        ioc.run();
+        return;
+    }
+
+    // 自旋模式：线程永不休眠，省掉 epoll_wait 的唤醒延迟，代价是独占一个核
+    std::cout << "[runtime] io thread in busy-poll mode" << std::endl;
+    auto guard = boost::asio::make_work_guard(ioc);
+    while (!ioc.stopped()) {
+        ioc.poll();
+    }
+}
+
+const char* io_backend_name() {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+    return "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+    return "epoll";
+#else
+    return "select";
+#endif
+}
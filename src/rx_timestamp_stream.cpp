@@ -0,0 +1,51 @@
+#include "rx_timestamp_stream.h"
+#include <linux/net_tstamp.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+bool enable_rx_timestamps(int fd) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+        std::cerr << "[rx_timestamp] SO_TIMESTAMPING failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::size_t recv_timestamped(int fd, iovec* iov, std::size_t iov_count, int64_t& rx_ns,
+                             boost::system::error_code& ec) {
+    // SCM_TIMESTAMPING 的负载是 3 个 timespec：[0] 软件，[1] 废弃，[2] 硬件
+    alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(timespec))];
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_count;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = ::recvmsg(fd, &msg, MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) ec = boost::asio::error::would_block;
+        else ec = boost::system::error_code(errno, boost::system::system_category());
+        return 0;
+    }
+    if (n == 0) {
+        ec = boost::asio::error::eof;
+        return 0;
+    }
+    ec = {};
+
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPING) continue;
+        timespec ts[3];
+        std::memcpy(ts, CMSG_DATA(c), sizeof(ts));
+        if (ts[0].tv_sec || ts[0].tv_nsec) rx_ns = ts[0].tv_sec * 1'000'000'000LL + ts[0].tv_nsec;
+    }
+    return static_cast<std::size_t>(n);
+}
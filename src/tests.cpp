@@ -1,13 +1,104 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_approx.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
 #include "../include/Aggregator.h"   // 调整路径
 #include "../include/binance_connector.h"
 #include "../include/okx_connector.h"
+#include "../include/bybit_connector.h"
 #include "../include/bitget_connector.h"
+#include "../include/book_signals.h"
+#include "../include/tick_store.h"
+#include "../include/book_history.h"
+#include "../include/depth_index.h"
+#include "../include/line_arbiter.h"
+#include "../include/cross_detector.h"
+#include "../include/rx_timestamp_stream.h"
+#include "../include/alloc_profile.h"
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <thread>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
+using Catch::Approx;
+
+// 测试检查内部状态的唯一入口：Aggregator 和 market_connector 把它声明为 friend
+struct test_access {
+    static constexpr std::size_t HANDOFF_MESSAGES = Aggregator::HANDOFF_MESSAGES;
+
+    // Aggregator 的状态
+    static auto& consolidated_bids(Aggregator& a) { return a.consolidated_bids_; }
+    static auto& consolidated_asks(Aggregator& a) { return a.consolidated_asks_; }
+    static auto& venue_names(Aggregator& a) { return a.venue_names_; }
+    static auto& latest_bbo(Aggregator& a) { return a.latest_bbo_; }
+    static auto& bbo(Aggregator& a) { return a.bbo_; }
+    static auto& venue_bbo(Aggregator& a) { return a.venue_bbo_; }
+    static auto& trade_ring(Aggregator& a) { return a.trade_ring_; }
+    static auto& trade_seq(Aggregator& a) { return a.trade_seq_; }
+    static auto& strand(Aggregator& a) { return a.strand_; }
+    static auto& version(Aggregator& a) { return a.version_; }
+    static auto& version_wall_ns(Aggregator& a) { return a.version_wall_ns_; }
+    static auto& snapshot_cfg(Aggregator& a) { return a.snapshot_cfg_; }
+    static auto& connectors(Aggregator& a) { return a.connectors_; }
+    static auto& backup_lines(Aggregator& a) { return a.backup_lines_; }
+    static auto& handoff_overflows(Aggregator& a) { return a.handoff_overflows_; }
+    static auto& strand_queue(Aggregator& a) { return a.strand_queue_; }
+    static auto& depth_index(Aggregator& a) { return a.depth_index_; }
+    static auto& history(Aggregator& a) { return a.history_; }
+
+    // Aggregator 的内部步骤
+    static void update_consolidated_book(Aggregator& a, std::size_t venue, const std::vector<level_change>& changes,
+                                         int64_t rx_ns = 0) {
+        a.update_consolidated_book(venue, changes, rx_ns);
+    }
+    static aggregator::BookUpdate build_book_update(Aggregator& a, bool with_venues) {
+        return a.build_book_update(with_venues);
+    }
+    static void update_bbo(Aggregator& a, std::size_t venue, const top_of_book& top) { a.update_bbo(venue, top); }
+    static void apply_relay_book(Aggregator& a, const aggregator::BookUpdate& u) { a.apply_relay_book(u); }
+    static void collect_stats(Aggregator& a, aggregator::Stats& out) { a.collect_stats(out); }
+    static bool any_venue_stale(Aggregator& a) { return a.any_venue_stale(); }
+    static void write_snapshot(Aggregator& a) { a.write_snapshot(); }
+    static void restore_snapshot(Aggregator& a) { a.restore_snapshot(); }
+    static auto add_subscriber(Aggregator& a, const char* rpc, grpc::ServerContext* ctx) {
+        return a.add_subscriber(rpc, ctx);
+    }
+    template <class Entry>
+    static void remove_subscriber(Aggregator& a, const std::shared_ptr<Entry>& sub) { a.remove_subscriber(sub); }
+    static grpc::Status GetBookAt(Aggregator& a, grpc::ServerContext* ctx, const aggregator::BookAtRequest* req,
+                                  aggregator::BookUpdate* resp) {
+        return a.GetBookAt(ctx, req, resp);
+    }
+    static grpc::Status QueryDepth(Aggregator& a, grpc::ServerContext* ctx, const aggregator::DepthQuery* req,
+                                   aggregator::DepthResult* resp) {
+        return a.QueryDepth(ctx, req, resp);
+    }
+
+    // market_connector
+    static void deliver(market_connector& c, std::size_t line, const std::string& msg) { c.deliver(line, msg); }
+    static void finish_message(market_connector& c) { c.finish_message(); }
+    static auto& pending_changes(market_connector& c) { return c.pending_changes_; }
+    static auto& stats(market_connector& c) { return c.stats_; }
+    static auto& strand(market_connector& c) { return c.strand_; }
+};
+
+// 统计全局 new 的次数，验证稳态路径不分配堆内存
+static std::atomic<std::size_t> g_heap_allocations{0};
+
+void* operator new(std::size_t n) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+#ifdef AGGREGATOR_ALLOC_PROFILE
+    alloc_profile_record(n);
+#endif
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
 
 TEST_CASE("Binance parse snapshot", "[parser][binance]") {
     // mock io_context（测试不需要真实运行 io）
@@ -24,12 +115,12 @@ TEST_CASE("Binance parse snapshot", "[parser][binance]") {
     connector.parse_message(msg);
 
     REQUIRE(connector.get_bids().size() == 2);
-    REQUIRE(connector.get_bids()[70400.0] == Approx(1.5));
-    REQUIRE(connector.get_bids()[70390.0] == Approx(0.8));
+    REQUIRE(connector.get_bids().at(70400.0) == Approx(1.5));
+    REQUIRE(connector.get_bids().at(70390.0) == Approx(0.8));
 
     REQUIRE(connector.get_asks().size() == 2);
-    REQUIRE(connector.get_asks()[70410.0] == Approx(2.0));
-    REQUIRE(connector.get_asks()[70420.0] == Approx(1.2));
+    REQUIRE(connector.get_asks().at(70410.0) == Approx(2.0));
+    REQUIRE(connector.get_asks().at(70420.0) == Approx(1.2));
 }
 
 TEST_CASE("OKX parse delta update", "[parser][okx]") {
@@ -46,7 +137,47 @@ TEST_CASE("OKX parse delta update", "[parser][okx]") {
     connector.parse_message(msg);
 
     REQUIRE(connector.get_bids().size() == 1);  // 0.0 被删除
-    REQUIRE(connector.get_bids()[70400.0] == Approx(1.5));
+    REQUIRE(connector.get_bids().at(70400.0) == Approx(1.5));
+}
+
+TEST_CASE("Binance snapshot reports only changed levels", "[parser][binance]") {
+    boost::asio::io_context mock_ioc;
+    binance_connector connector(mock_ioc, nullptr, "Binance", "host", "port", "path", nullptr);
+
+    connector.parse_message(R"({"lastUpdateId": 1,
+        "bids": [["70400.00", "1.5"], ["70390.00", "0.8"]], "asks": [["70410.00", "2.0"]]})");
+    REQUIRE(test_access::pending_changes(connector).size() == 3);
+    test_access::pending_changes(connector).clear();
+
+    // 第二条快照：70400 数量不变，70390 消失，70380 新增
+    connector.parse_message(R"({"lastUpdateId": 2,
+        "bids": [["70400.00", "1.5"], ["70380.00", "0.3"]], "asks": [["70410.00", "2.0"]]})");
+    const auto& changes = test_access::pending_changes(connector);
+    REQUIRE(changes.size() == 2);
+    REQUIRE(changes[0].price == Approx(70380.0));
+    REQUIRE(changes[0].qty == Approx(0.3));
+    REQUIRE(changes[1].price == Approx(70390.0));
+    REQUIRE(changes[1].qty == 0.0);
+}
+
+TEST_CASE("Snapshot that fails to parse keeps the previous book", "[parser][binance]") {
+    boost::asio::io_context mock_ioc;
+    binance_connector connector(mock_ioc, nullptr, "Binance", "host", "port", "path", nullptr);
+
+    connector.parse_message(R"({"lastUpdateId": 1,
+        "bids": [["70400.00", "1.5"], ["70390.00", "0.8"]], "asks": [["70410.00", "2.0"]]})");
+    test_access::finish_message(connector);
+
+    // 第一档解析完后遇到坏数量：不能把没解析到的 70390 和卖方档位当成删除
+    connector.parse_message(R"({"lastUpdateId": 2,
+        "bids": [["70400.00", "1.6"], ["70390.00", "bad"]], "asks": [["70410.00", "2.0"]]})");
+    test_access::finish_message(connector);
+
+    REQUIRE(test_access::stats(connector).parse_errors == 1);
+    REQUIRE(test_access::pending_changes(connector).empty());
+    REQUIRE(connector.get_bids().size() == 2);
+    REQUIRE(connector.get_bids().at(70400.0) == Approx(1.5));
+    REQUIRE(connector.get_asks().size() == 1);
 }
 
 TEST_CASE("Aggregator consolidates books", "[aggregator][consolidation]") {
@@ -54,22 +185,901 @@ TEST_CASE("Aggregator consolidates books", "[aggregator][consolidation]") {
     boost::asio::io_context ioc;
     Aggregator agg(ioc);
 
-    auto conn1 = std::make_shared<binance_connector>(ioc, &agg, "Binance", "host", "port", "path", nullptr);
-    conn1->get_bids() = {{70400.0, 1.0}, {70390.0, 2.0}};
-    conn1->get_asks() = {{70410.0, 3.0}};
+    // venue 0 / venue 1 各自上报的档位变化
+    test_access::update_consolidated_book(agg, 0, {{book_side::bid, 70400.0, 1.0}, {book_side::bid, 70390.0, 2.0},
+                                     {book_side::ask, 70410.0, 3.0}});
+    test_access::update_consolidated_book(agg, 1, {{book_side::bid, 70400.0, 1.5}, {book_side::bid, 70395.0, 0.5},
+                                     {book_side::ask, 70410.0, 1.0}, {book_side::ask, 70420.0, 2.0}});
+
+    REQUIRE(test_access::consolidated_bids(agg).at(70400.0).total == Approx(2.5));
+    REQUIRE(test_access::consolidated_bids(agg).at(70390.0).total == Approx(2.0));
+    REQUIRE(test_access::consolidated_bids(agg).at(70395.0).total == Approx(0.5));
+
+    REQUIRE(test_access::consolidated_asks(agg).at(70410.0).total == Approx(4.0));
+    REQUIRE(test_access::consolidated_asks(agg).at(70420.0).total == Approx(2.0));
+}
+
+TEST_CASE("Aggregator keeps per-venue quantities", "[aggregator][consolidation]") {
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+
+    test_access::update_consolidated_book(agg, 0, {{book_side::bid, 70400.0, 1.0}});
+    test_access::update_consolidated_book(agg, 1, {{book_side::bid, 70400.0, 1.5}});
+
+    const auto& lvl = test_access::consolidated_bids(agg).at(70400.0);
+    REQUIRE(lvl.by_venue[0] == Approx(1.0));
+    REQUIRE(lvl.by_venue[1] == Approx(1.5));
+
+    // venue 0 撤单后只剩 venue 1，两家都撤完该档删除
+    test_access::update_consolidated_book(agg, 0, {{book_side::bid, 70400.0, 0.0}});
+    REQUIRE(test_access::consolidated_bids(agg).at(70400.0).total == Approx(1.5));
+    test_access::update_consolidated_book(agg, 1, {{book_side::bid, 70400.0, 0.0}});
+    REQUIRE(test_access::consolidated_bids(agg).count(70400.0) == 0);
+}
+
+TEST_CASE("Signals follow consolidated book changes", "[signals]") {
+    book_memory mem;
+    consolidated_bid_book bids(mem.resource());
+    consolidated_ask_book asks(mem.resource());
+    book_signals signals(signal_config{2, 1.5});
+
+    auto set = [&](book_side side, double price, double qty) {
+        if (side == book_side::bid) apply_venue_level(bids, 0, price, qty);
+        else apply_venue_level(asks, 0, price, qty);
+        signals.on_level_changed(side, price);
+    };
+
+    set(book_side::bid, 100.0, 1.0);
+    set(book_side::bid, 99.0, 1.0);
+    set(book_side::bid, 98.0, 4.0);
+    set(book_side::ask, 101.0, 3.0);
+    set(book_side::ask, 102.0, 1.0);
+    set(book_side::ask, 103.0, 1.0);
+    REQUIRE(signals.refresh(bids, asks));
+
+    const auto& v = signals.values();
+    REQUIRE(v.microprice == Approx((100.0 * 3.0 + 101.0 * 1.0) / 4.0));
+    REQUIRE(v.imbalance == Approx((2.0 - 4.0) / 6.0));         // 前 2 档
+    REQUIRE(v.bid_vwap == Approx((100.0 * 1.0 + 99.0 * 0.5) / 1.5));
+    REQUIRE(v.ask_vwap == Approx(101.0));
+
+    // 覆盖区域之外的变化不触发重算
+    set(book_side::bid, 90.0, 7.0);
+    set(book_side::ask, 110.0, 7.0);
+    REQUIRE_FALSE(signals.refresh(bids, asks));
+
+    // 新的最优价进入前 N 档
+    set(book_side::bid, 100.5, 2.0);
+    REQUIRE(signals.refresh(bids, asks));
+    REQUIRE(signals.values().best_bid == Approx(100.5));
+    REQUIRE(signals.values().imbalance == Approx((3.0 - 4.0) / 7.0));
+}
+
+TEST_CASE("Aggregator warm restart from snapshot", "[aggregator][snapshot]") {
+    const std::string path = "test_book.snap";
+    {
+        boost::asio::io_context ioc;
+        Aggregator agg(ioc);
+        test_access::venue_names(agg) = {"Binance", "OKX"};
+        test_access::snapshot_cfg(agg).path = path;
+        test_access::update_consolidated_book(agg, 0, {{book_side::bid, 70400.0, 1.0}, {book_side::ask, 70410.0, 2.0}});
+        test_access::update_consolidated_book(agg, 1, {{book_side::bid, 70400.0, 0.5}, {book_side::bid, 70390.0, 3.0}});
+        ioc.poll();  // 发布版本后才会落盘
+        test_access::write_snapshot(agg);
+    }
+
+    // 重启后交易所顺序变了：按名字映射
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"OKX", "Binance"};
+    test_access::snapshot_cfg(agg).path = path;
+    test_access::restore_snapshot(agg);
+
+    REQUIRE(test_access::any_venue_stale(agg));
+    REQUIRE(test_access::consolidated_bids(agg).at(70400.0).total == Approx(1.5));
+    REQUIRE(test_access::consolidated_bids(agg).at(70400.0).by_venue[1] == Approx(1.0));  // Binance
+    REQUIRE(test_access::consolidated_bids(agg).at(70390.0).by_venue[0] == Approx(3.0));  // OKX
+    REQUIRE(test_access::build_book_update(agg, false).stale());
+
+    // Binance 第一条实时数据：它在快照里的档位全部作废
+    test_access::update_consolidated_book(agg, 1, {{book_side::bid, 70405.0, 2.0}});
+    REQUIRE(test_access::consolidated_bids(agg).at(70400.0).total == Approx(0.5));
+    REQUIRE(test_access::consolidated_asks(agg).count(70410.0) == 0);
+    REQUIRE(test_access::consolidated_bids(agg).at(70405.0).total == Approx(2.0));
+
+    test_access::update_consolidated_book(agg, 0, {{book_side::bid, 70390.0, 3.0}});
+    REQUIRE_FALSE(test_access::any_venue_stale(agg));
+    REQUIRE(test_access::consolidated_bids(agg).count(70400.0) == 0);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Aggregator coalesces bursts into one version", "[aggregator][coalesce]") {
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+
+    // 10 条更新同时排在 strand 上：全部应用，只发布一个版本
+    for (int i = 0; i < 10; ++i) {
+        boost::asio::post(test_access::strand(agg), [&agg, i] {
+            test_access::update_consolidated_book(agg, i % 2, {{book_side::bid, 70400.0 - i, 1.0}});
+        });
+    }
+    ioc.run();
+
+    REQUIRE(test_access::consolidated_bids(agg).size() == 10);
+    REQUIRE(test_access::version(agg).load() == 1);
+    auto stats = agg.coalescing();
+    REQUIRE(stats.updates == 10);
+    REQUIRE(stats.versions == 1);
+    REQUIRE(stats.coalesced == 9);
+    REQUIRE(stats.max_burst == 10);
+
+    // 单独到达的更新各自成一个版本
+    ioc.restart();
+    boost::asio::post(test_access::strand(agg), [&agg] {
+        test_access::update_consolidated_book(agg, 0, {{book_side::ask, 70410.0, 1.0}});
+    });
+    ioc.run();
+    REQUIRE(test_access::version(agg).load() == 2);
+    REQUIRE(agg.coalescing().coalesced == 9);
+
+    // BookUpdate 的时间戳是版本发布的时刻，推送线程晚些构建也不变
+    const int64_t published = test_access::build_book_update(agg, false).timestamp_ns();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    REQUIRE(published == test_access::version_wall_ns(agg));
+    REQUIRE(test_access::build_book_update(agg, false).timestamp_ns() == published);
+}
+
+TEST_CASE("BBO fast path from venue tops", "[aggregator][bbo]") {
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance", "OKX"};
+
+    test_access::update_bbo(agg, 0, {70400.0, 1.0, 70410.0, 2.0});
+    test_access::update_bbo(agg, 1, {70400.0, 0.5, 70405.0, 3.0});
+    REQUIRE(test_access::latest_bbo(agg).seq() == 2);
+    REQUIRE(test_access::latest_bbo(agg).bid_price() == Approx(70400.0));
+    REQUIRE(test_access::latest_bbo(agg).bid_qty() == Approx(1.5));      // 两家同价，数量相加
+    REQUIRE(test_access::latest_bbo(agg).ask_price() == Approx(70405.0));
+    REQUIRE(test_access::latest_bbo(agg).ask_qty() == Approx(3.0));
+    REQUIRE(test_access::latest_bbo(agg).venues_size() == 2);
+    REQUIRE(test_access::latest_bbo(agg).venues(1).venue() == "OKX");
+
+    // 最优价没变（只动了深度）不推送
+    test_access::update_bbo(agg, 0, {70400.0, 1.0, 70410.0, 2.0});
+    REQUIRE(test_access::latest_bbo(agg).seq() == 2);
+
+    // OKX 一侧清空
+    test_access::update_bbo(agg, 1, {70400.0, 0.5, 0.0, 0.0});
+    REQUIRE(test_access::latest_bbo(agg).seq() == 3);
+    REQUIRE(test_access::latest_bbo(agg).ask_price() == Approx(70410.0));
+}
+
+TEST_CASE("Cross detector tracks locked and crossed venue pairs", "[crosses]") {
+    cross_detector det;
+    std::array<top_of_book, MAX_VENUES> tops{};
+    std::vector<cross_event> events;
+
+    tops[0] = {100.0, 1.0, 101.0, 1.0};
+    tops[1] = {99.0, 2.0, 102.0, 2.0};
+    det.on_venue_top(1, tops, 2, 1000, events);
+    REQUIRE(events.empty());
+
+    // venue 1 买价碰到 venue 0 卖价：locked
+    tops[1] = {101.0, 2.0, 102.0, 2.0};
+    det.on_venue_top(1, tops, 2, 2000, events);
+    REQUIRE(events.size() == 1);
+    REQUIRE(events[0].kind == cross_kind::locked);
+    REQUIRE(events[0].bid_venue == 1);
+    REQUIRE(events[0].ask_venue == 0);
+    REQUIRE(events[0].size == Approx(1.0));
+
+    // 继续上抬变成 crossed；同一状态内数量变化不发事件
+    tops[1] = {101.5, 2.0, 102.0, 2.0};
+    det.on_venue_top(1, tops, 2, 3000, events);
+    tops[1] = {101.5, 0.5, 102.0, 2.0};
+    det.on_venue_top(1, tops, 2, 3500, events);
+    REQUIRE(events.size() == 2);
+    REQUIRE(events[1].kind == cross_kind::crossed);
+    REQUIRE(det.state(1, 0) == cross_kind::crossed);
+
+    // venue 0 卖价上移，交叉结束：持续时间从 locked 开始算
+    tops[0] = {100.0, 1.0, 102.0, 1.0};
+    det.on_venue_top(0, tops, 2, 5000, events);
+    REQUIRE(events.size() == 3);
+    REQUIRE(events[2].kind == cross_kind::none);
+    REQUIRE(events[2].duration_ns == 3000);
+    REQUIRE(events[2].size == Approx(0.5));
+    REQUIRE(det.state(1, 0) == cross_kind::none);
+}
+
+TEST_CASE("GetStats reads connector and aggregator counters on their strands", "[aggregator][stats]") {
+    boost::asio::io_context ioc;
+    auto work = boost::asio::make_work_guard(ioc);
+    std::thread io([&ioc] { ioc.run(); });
+
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance"};
+    auto c = std::make_shared<binance_connector>(ioc, &agg, "Binance", "host", "port", "path", nullptr);
+    test_access::connectors(agg).push_back(c);
+
+    boost::asio::post(test_access::strand(*c), [c] {
+        test_access::deliver(*c, 0, R"({"lastUpdateId":1,"bids":[["70400.0","1.0"]],"asks":[["70410.0","2.0"]]})");
+        test_access::deliver(*c, 0, "{not json");
+    });
+    auto sub = test_access::add_subscriber(agg, "SubscribeBook", nullptr);
+    sub->messages = 3;
+
+    aggregator::Stats stats;
+    // 第一次收集排在上面的消息之后；合并簿版本在这之后才发布，所以再取一次
+    test_access::collect_stats(agg, stats);
+    stats.Clear();
+    test_access::collect_stats(agg, stats);
+
+    REQUIRE(stats.connectors_size() == 1);
+    REQUIRE(stats.connectors(0).venue() == "Binance");
+    REQUIRE(stats.connectors(0).parse_errors() == 1);
+    REQUIRE(stats.aggregator().updates() == 1);
+    REQUIRE(stats.aggregator().version() == 1);
+    REQUIRE(stats.aggregator().bid_levels() == 1);
+    REQUIRE(stats.aggregator().strand_queue() == 0);
+    REQUIRE(stats.subscribers_size() == 1);
+    REQUIRE(stats.subscribers(0).messages() == 3);
+
+    test_access::remove_subscriber(agg, sub);
+    work.reset();
+    io.join();
+}
+
+TEST_CASE("GetStats reports A/B line wins and duplicates", "[aggregator][stats]") {
+    boost::asio::io_context ioc;
+    auto work = boost::asio::make_work_guard(ioc);
+    std::thread io([&ioc] { ioc.run(); });
+
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance"};
+    auto c = std::make_shared<binance_connector>(ioc, &agg, "Binance", "host", "port", "path", nullptr);
+    auto backup = std::make_shared<binance_connector>(ioc, &agg, "Binance", "host", "port", "path", nullptr);
+    c->set_line_count(2);
+    backup->set_primary(c.get(), 1);
+    test_access::connectors(agg).push_back(c);
+    test_access::backup_lines(agg).push_back(backup);
+
+    // 1 号在两条线上都到了（主线路先到），2 号只有备线收到
+    boost::asio::post(test_access::strand(*c), [c] {
+        const std::string first = R"({"lastUpdateId":1,"bids":[["70400.0","1.0"]],"asks":[["70410.0","2.0"]]})";
+        test_access::deliver(*c, 0, first);
+        test_access::deliver(*c, 1, first);
+        test_access::deliver(*c, 1, R"({"lastUpdateId":2,"bids":[["70400.0","1.5"]],"asks":[["70410.0","2.0"]]})");
+    });
+
+    aggregator::Stats stats;
+    test_access::collect_stats(agg, stats);
+
+    REQUIRE(stats.connectors_size() == 2);
+    REQUIRE(stats.connectors(0).line() == 0);
+    REQUIRE(stats.connectors(0).line_wins() == 1);
+    REQUIRE(stats.connectors(0).line_duplicates() == 0);
+    REQUIRE(stats.connectors(1).line() == 1);
+    REQUIRE(stats.connectors(1).line_wins() == 1);
+    REQUIRE(stats.connectors(1).line_duplicates() == 1);
+
+    work.reset();
+    io.join();
+}
+
+TEST_CASE("Steady-state book handoff does not touch the heap", "[aggregator][alloc]") {
+    // 与生产一样：io 线程一直 run()，另一个线程（相当于 connector）投递变化
+    boost::asio::io_context ioc;
+    auto work = boost::asio::make_work_guard(ioc);
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance"};
+    auto c = std::make_shared<binance_connector>(ioc, &agg, "Binance", "host", "port", "path", nullptr);
+    std::thread io([&ioc] { ioc.run(); });
+
+    // 与 connector 一样复用同一个变化缓冲区：交接环拷走内容，调用方不用每条消息重新分配
+    constexpr int ROUNDS = 1000;
+    std::vector<level_change> changes;
+    changes.reserve(2);
+    const top_of_book top{70009.0, 1.0, 70100.0, 1.0};
+
+    // 每轮等合并簿发布完再投递下一条，保证每条消息都走完整的 交接 -> 应用 -> 发布
+    auto round = [&](int i) {
+        changes.clear();
+        changes.push_back({book_side::bid, 70000.0 + i % 10, 1.0 + i});
+        changes.push_back({book_side::ask, 70100.0 + i % 10, 1.0 + i});
+        agg.on_book_updated(c.get(), changes, top, 0);
+        while (agg.coalescing().versions < static_cast<uint64_t>(i + 1)) std::this_thread::yield();
+    };
+
+    // 预热：档位节点、回调内存块都分配过一次
+    for (int i = 0; i < ROUNDS; ++i) round(i);
+    std::size_t pooled = c->handler_mem()->upstream_allocations();
+
+    std::size_t before = g_heap_allocations.load();
+    for (int i = ROUNDS; i < 2 * ROUNDS; ++i) round(i);
+    std::size_t after = g_heap_allocations.load();
+
+    work.reset();
+    io.join();
+
+    REQUIRE(agg.coalescing().versions == 2 * ROUNDS);
+    REQUIRE(after - before == 0);
+    REQUIRE(c->handler_mem()->upstream_allocations() == pooled);
+}
+
+TEST_CASE("Allocation profile attributes allocations to the current stage", "[alloc_profile]") {
+    REQUIRE(std::string(alloc_stage_name(alloc_stage::consolidate)) == "consolidate");
+    REQUIRE(std::string(alloc_stage_name(alloc_stage::write)) == "write");
+
+    alloc_profile_reset();
+    {
+        alloc_scope parse(alloc_stage::parse);
+        // 直接调用 operator new：new 表达式配对的 delete 可能被编译器整个省掉
+        ::operator delete(::operator new(100));
+        {
+            alloc_scope build(alloc_stage::build);
+            ::operator delete(::operator new(40));
+        }
+        ::operator delete(::operator new(60));   // 内层退出后回到 parse
+    }
+    const alloc_profile profile = alloc_profile_snapshot();
+    const auto& parse = profile[static_cast<std::size_t>(alloc_stage::parse)];
+    const auto& build = profile[static_cast<std::size_t>(alloc_stage::build)];
+
+    if (alloc_profile_enabled) {
+        REQUIRE(parse.allocations == 2);
+        REQUIRE(parse.bytes == 160);
+        REQUIRE(build.allocations == 1);
+        REQUIRE(build.bytes == 40);
+    } else {
+        for (const auto& s : profile) REQUIRE(s.allocations == 0);
+    }
+}
+
+TEST_CASE("SPSC handoff keeps venue order when the ring overflows", "[aggregator][handoff]") {
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance", "OKX"};
+    auto binance = std::make_shared<binance_connector>(ioc, &agg, "Binance", "host", "port", "path", nullptr);
+    auto okx = std::make_shared<okx_connector>(ioc, &agg, "OKX", "host", "port", "path", nullptr);
+    okx->set_venue_id(1);
+
+    // strand 不运行：超过环容量的消息退回按值 post，之后的消息在退回的执行完之前也不再进环
+    const std::size_t total = test_access::HANDOFF_MESSAGES + 100;
+    std::vector<level_change> changes(1);
+    for (std::size_t i = 0; i < total; ++i) {
+        changes[0] = {book_side::bid, 70000.0 + i % 7, 1.0 + i};
+        agg.on_book_updated(binance.get(), changes, top_of_book{70006.0, 1.0, 0.0, 0.0}, 0);
+    }
+    changes[0] = {book_side::ask, 70100.0, 2.0};
+    agg.on_book_updated(okx.get(), changes, top_of_book{0.0, 0.0, 70100.0, 2.0}, 0);
+    REQUIRE(test_access::handoff_overflows(agg).load() == 100);
+    REQUIRE(test_access::strand_queue(agg).load() == static_cast<int64_t>(total + 1));
+
+    ioc.run();
+
+    // 每个价位上是最后一次写入的数量：同一交易所的消息没有乱序
+    REQUIRE(agg.coalescing().updates == total + 1);
+    REQUIRE(test_access::strand_queue(agg).load() == 0);
+    for (std::size_t p = 0; p < 7; ++p) {
+        std::size_t last = total - 1 - (total - 1 - p) % 7;
+        REQUIRE(test_access::consolidated_bids(agg).at(70000.0 + p).total == Approx(1.0 + last));
+    }
+    REQUIRE(test_access::consolidated_asks(agg).at(70100.0).by_venue[1] == Approx(2.0));
+
+    // 退回的消息执行完后重新走环
+    ioc.restart();
+    changes[0] = {book_side::bid, 69000.0, 1.0};
+    agg.on_book_updated(binance.get(), changes, top_of_book{70006.0, 1.0, 0.0, 0.0}, 0);
+    ioc.run();
+    REQUIRE(test_access::handoff_overflows(agg).load() == 100);
+    REQUIRE(test_access::consolidated_bids(agg).count(69000.0) == 1);
+}
+
+TEST_CASE("Kernel receive timestamps reach the published book", "[rx_timestamp]") {
+    using tcp = boost::asio::ip::tcp;
+    auto wall_ns = [] {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    };
+
+    boost::asio::io_context ioc;
+    tcp::acceptor acceptor(ioc, {boost::asio::ip::address_v4::loopback(), 0});
+    rx_timestamp_stream client(ioc.get_executor());
+    client.next_layer().connect(acceptor.local_endpoint());
+    tcp::socket server = acceptor.accept();
+    REQUIRE(enable_rx_timestamps(client.lowest_layer().native_handle()));
+
+    // 先挂读再写：第一次 recvmsg 没数据，走 async_wait 路径
+    std::array<char, 16> buf{};
+    std::size_t got = 0;
+    boost::system::error_code read_ec;
+    alloc_profile_reset();
+    client.async_read_some(boost::asio::buffer(buf), [&](boost::system::error_code ec, std::size_t n) {
+        read_ec = ec;
+        got = n;
+        ::operator delete(::operator new(70));   // 上层读操作在完成回调里的分配记到 read
+    });
+    ioc.poll();
+    const int64_t sent_ns = wall_ns();
+    boost::asio::write(server, boost::asio::buffer("hello", 5));
+    ioc.run();
+    const int64_t read_ns = wall_ns();
+
+    REQUIRE(!read_ec);
+    REQUIRE(got == 5);
+    REQUIRE(client.last_rx_ns() >= sent_ns);
+    REQUIRE(client.last_rx_ns() <= read_ns);
+    if (alloc_profile_enabled) REQUIRE(alloc_profile_snapshot()[static_cast<std::size_t>(alloc_stage::read)].bytes >= 70);
+
+    // 数据已经在 socket 里：回调不在发起函数里直接执行
+    boost::asio::write(server, boost::asio::buffer("world", 5));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    got = 0;
+    client.async_read_some(boost::asio::buffer(buf), [&](boost::system::error_code ec, std::size_t n) { got = n; });
+    REQUIRE(got == 0);
+    ioc.restart();
+    ioc.run();
+    REQUIRE(got == 5);
+    REQUIRE(client.last_rx_ns() > sent_ns);
+
+    // 合并簿发出的 BookUpdate 带最新一条消息的接收时间
+    Aggregator agg(ioc);
+    test_access::update_consolidated_book(agg, 0, {{book_side::bid, 70400.0, 1.0}}, client.last_rx_ns());
+    test_access::update_consolidated_book(agg, 1, {{book_side::bid, 70390.0, 1.0}}, client.last_rx_ns() - 1000);
+    REQUIRE(test_access::build_book_update(agg, false).rx_timestamp_ns() == client.last_rx_ns());
+}
+
+TEST_CASE("Venue trades are normalised into the merged tape", "[trades]") {
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance", "OKX", "Bybit"};
+    binance_connector binance(ioc, &agg, "Binance", "host", "port", "path", nullptr);
+    okx_connector okx(ioc, &agg, "OKX", "host", "port", "path", nullptr);
+    bybit_connector bybit(ioc, &agg, "Bybit", "host", "port", "path", nullptr);
+    okx.set_venue_id(1);
+    bybit.set_venue_id(2);
+
+    test_access::deliver(binance, 0, R"({"e":"trade","E":1700000000001,"s":"BTCUSDT","t":101,"p":"70400.10","q":"0.5",)"
+                       R"("T":1700000000000,"m":true,"M":true})");
+    test_access::deliver(okx, 0, R"({"arg":{"channel":"trades","instId":"BTC-USDT"},"data":[)"
+                   R"({"instId":"BTC-USDT","tradeId":"202","px":"70401","sz":"0.1","side":"buy","ts":"1700000000002"},)"
+                   R"({"instId":"BTC-USDT","tradeId":"203","px":"70402","sz":"0.2","side":"sell","ts":"1700000000003"}]})");
+    test_access::deliver(bybit, 0, R"({"topic":"publicTrade.BTCUSDT","type":"snapshot","ts":1700000000005,"data":[)"
+                     R"({"i":"2290000000000000304","T":1700000000004,"p":"70403.5","v":"0.3","S":"Buy","s":"BTCUSDT","BT":false}]})");
+    // 订阅确认不是成交
+    test_access::deliver(binance, 0, R"({"result":null,"id":1})");
+
+    REQUIRE(binance.get_bids().empty());  // 成交不改本地簿
+    REQUIRE(test_access::trade_seq(agg) == 4);
+    const auto& t1 = test_access::trade_ring(agg)[1];
+    REQUIRE(t1.venue == 0);
+    REQUIRE(t1.price == Approx(70400.10));
+    REQUIRE(t1.qty == Approx(0.5));
+    REQUIRE(t1.aggressor == book_side::ask);  // m = 买方挂单，卖方主动
+    REQUIRE(t1.exchange_ts_ms == 1700000000000);
+    REQUIRE(t1.trade_id == 101);
+
+    REQUIRE(test_access::trade_ring(agg)[2].venue == 1);
+    REQUIRE(test_access::trade_ring(agg)[2].aggressor == book_side::bid);
+    REQUIRE(test_access::trade_ring(agg)[3].trade_id == 203);
+    REQUIRE(test_access::trade_ring(agg)[3].aggressor == book_side::ask);
+
+    const auto& t4 = test_access::trade_ring(agg)[4];
+    REQUIRE(t4.venue == 2);
+    REQUIRE(t4.price == Approx(70403.5));
+    REQUIRE(t4.trade_id == 2290000000000000304ULL);
+    REQUIRE(t4.aggressor == book_side::bid);
+
+    // A/B 线：成交从先到的线路取，另一条线上的同一笔按成交号丢掉；主线路断开时备线照样出成交
+    binance.set_line_count(2);
+    auto trade = [](int id) {
+        return R"({"e":"trade","E":1700000000001,"s":"BTCUSDT","t":)" + std::to_string(id) +
+               R"(,"p":"70400.10","q":"0.5","T":1700000000000,"m":true,"M":true})";
+    };
+    test_access::deliver(binance, 0, trade(102));
+    test_access::deliver(binance, 1, trade(102));
+    test_access::deliver(binance, 1, trade(103));
+    test_access::deliver(binance, 0, trade(103));
+    test_access::deliver(binance, 1, trade(104));
+    REQUIRE(test_access::trade_seq(agg) == 7);
+    REQUIRE(test_access::trade_ring(agg)[5].trade_id == 102);
+    REQUIRE(test_access::trade_ring(agg)[6].trade_id == 103);
+    REQUIRE(test_access::trade_ring(agg)[7].trade_id == 104);
+}
+
+TEST_CASE("Relay rebuilds the consolidated book from upstream updates", "[relay]") {
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance", "OKX"};
+
+    auto add_level = [](google::protobuf::RepeatedPtrField<aggregator::Level>* side, double price,
+                        std::vector<double> venue_qty) {
+        auto* l = side->Add();
+        l->set_price(price);
+        for (double q : venue_qty) {
+            l->set_quantity(l->quantity() + q);
+            l->add_venue_quantities(q);
+        }
+    };
+
+    // 上游的交易所顺序与本地不同，按名字对上
+    aggregator::BookUpdate first;
+    first.add_venues("OKX");
+    first.add_venues("Binance");
+    first.set_rx_timestamp_ns(123);
+    add_level(first.mutable_bids(), 70400.0, {1.0, 2.0});
+    add_level(first.mutable_bids(), 70390.0, {0.0, 0.5});
+    add_level(first.mutable_asks(), 70410.0, {3.0, 0.0});
+    test_access::apply_relay_book(agg, first);
+    ioc.run();
+
+    REQUIRE(test_access::consolidated_bids(agg).size() == 2);
+    REQUIRE(test_access::consolidated_bids(agg).at(70400.0).by_venue[0] == Approx(2.0));
+    REQUIRE(test_access::consolidated_bids(agg).at(70400.0).by_venue[1] == Approx(1.0));
+    REQUIRE(test_access::consolidated_bids(agg).at(70390.0).total == Approx(0.5));
+    REQUIRE(test_access::consolidated_asks(agg).at(70410.0).by_venue[1] == Approx(3.0));
+    REQUIRE(test_access::version(agg).load() == 1);
+    REQUIRE(test_access::bbo(agg).bid_price == Approx(70400.0));
+    REQUIRE(test_access::bbo(agg).bid_qty == Approx(3.0));
+    REQUIRE(test_access::bbo(agg).ask_qty == Approx(3.0));
+    REQUIRE(test_access::build_book_update(agg, false).rx_timestamp_ns() == 123);
+
+    // 第二份：70400 只剩 Binance，70390 消失，OKX 新挂 70380
+    aggregator::BookUpdate second;
+    second.add_venues("OKX");
+    second.add_venues("Binance");
+    add_level(second.mutable_bids(), 70400.0, {0.0, 2.0});
+    add_level(second.mutable_bids(), 70380.0, {4.0, 0.0});
+    add_level(second.mutable_asks(), 70410.0, {3.0, 0.0});
+    test_access::apply_relay_book(agg, second);
+    ioc.restart();
+    ioc.run();
+
+    REQUIRE(test_access::consolidated_bids(agg).size() == 2);
+    REQUIRE(test_access::consolidated_bids(agg).at(70400.0).total == Approx(2.0));
+    REQUIRE(test_access::consolidated_bids(agg).count(70390.0) == 0);
+    REQUIRE(test_access::consolidated_bids(agg).at(70380.0).by_venue[1] == Approx(4.0));
+    REQUIRE(test_access::version(agg).load() == 2);
+    REQUIRE(test_access::bbo(agg).bid_qty == Approx(2.0));
+    REQUIRE(test_access::venue_bbo(agg)[1].bid_price == Approx(70380.0));
+
+    // 一样的簿不产生变化，也不出新版本
+    test_access::apply_relay_book(agg, second);
+    ioc.restart();
+    ioc.run();
+    REQUIRE(test_access::version(agg).load() == 2);
+}
+
+TEST_CASE("Tick store append and range query", "[tick_store]") {
+    const std::string dir = "test_ticks";
+    const int64_t day_ns = 20000LL * 86'400LL * 1'000'000'000LL;
+
+    book_memory mem;
+    consolidated_bid_book bids(mem.resource());
+    consolidated_ask_book asks(mem.resource());
+    apply_venue_level(bids, 0, 100.0, 1.0);
+    apply_venue_level(bids, 0, 99.0, 2.0);
+    apply_venue_level(asks, 0, 101.0, 3.0);
+    {
+        tick_store store(tick_store_config{dir, "BTCUSDT", 3});
+        store.append(day_ns + 1000, 1, bids, asks);
+        apply_venue_level(asks, 0, 100.5, 0.5);
+        store.append(day_ns + 2000, 2, bids, asks);
+        store.append(day_ns + 3000, 3, bids, asks);
+
+        // 写在后台线程；flush 之后读端能看到全部行
+        store.flush();
+        tick_reader live;
+        REQUIRE(live.open(dir, "BTCUSDT", tick_partition_name(day_ns)));
+        REQUIRE(live.rows() == 3);
+    }
+
+    tick_reader reader;
+    REQUIRE(reader.open(dir, "BTCUSDT", tick_partition_name(day_ns)));
+    REQUIRE(reader.rows() == 3);
+    REQUIRE(reader.depth() == 3);
+
+    uint64_t row = reader.lower_bound(day_ns + 1500);
+    REQUIRE(row == 1);
+    REQUIRE(reader.seq(row) == 2);
+    REQUIRE(reader.bid_px(row)[1] == Approx(99.0));
+    REQUIRE(reader.bid_qty(row)[2] == Approx(0.0));   // 缺档补 0
+    REQUIRE(reader.ask_px(row)[0] == Approx(100.5));
+    REQUIRE(reader.ask_qty(row)[1] == Approx(3.0));
+
+    // 模拟上次进程在逐列提交中途退出：ts 多了一行，重开时各列对齐到最短的一列
+    {
+        column_file ts;
+        REQUIRE(ts.open_append(dir + "/BTCUSDT/" + tick_partition_name(day_ns) + "/ts.col", sizeof(int64_t)));
+        const int64_t extra = day_ns + 4000;
+        REQUIRE(ts.append(&extra));
+        ts.commit();
+    }
+    {
+        tick_store store(tick_store_config{dir, "BTCUSDT", 3});
+        store.append(day_ns + 5000, 5, bids, asks);
+    }
+    REQUIRE(reader.open(dir, "BTCUSDT", tick_partition_name(day_ns)));
+    REQUIRE(reader.rows() == 4);
+    REQUIRE(reader.ts(3) == day_ns + 5000);
+    REQUIRE(reader.seq(3) == 5);
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Book history rebuilds past versions from checkpoints and deltas", "[history]") {
+    const int64_t s = 1'000'000'000LL;
+    book_memory mem;
+    consolidated_bid_book bids(mem.resource());
+    consolidated_ask_book asks(mem.resource());
+
+    // 保留 2 秒，每 2 条变化一个检查点
+    book_history history(history_config{2, 2, 10000, 100});
+    auto publish = [&](int64_t ts_ns, uint64_t version, std::size_t venue, level_change c) {
+        if (c.side == book_side::bid) apply_venue_level(bids, venue, c.price, c.qty);
+        else apply_venue_level(asks, venue, c.price, c.qty);
+        history.add(venue, c);
+        history.commit(ts_ns, version, bids, asks);
+    };
+    publish(1 * s, 1, 0, {book_side::bid, 100.0, 1.0});   // 第一个版本就是检查点
+    publish(2 * s, 2, 1, {book_side::bid, 100.0, 2.0});
+    publish(3 * s, 3, 0, {book_side::ask, 101.0, 3.0});   // 累计 2 条，检查点
+    publish(4 * s, 4, 0, {book_side::bid, 100.0, 0.0});
+
+    book_memory out_mem;
+    consolidated_bid_book out_bids(out_mem.resource());
+    consolidated_ask_book out_asks(out_mem.resource());
+    uint64_t version = 0;
+    int64_t ts = 0;
+
+    REQUIRE_FALSE(history.book_at(s / 2, out_bids, out_asks, version, ts));
+
+    REQUIRE(history.book_at(2 * s + s / 2, out_bids, out_asks, version, ts));
+    REQUIRE(version == 2);
+    REQUIRE(ts == 2 * s);
+    REQUIRE(out_bids.at(100.0).total == Approx(3.0));
+    REQUIRE(out_bids.at(100.0).by_venue[1] == Approx(2.0));
+    REQUIRE(out_asks.empty());
+
+    REQUIRE(history.book_at(10 * s, out_bids, out_asks, version, ts));
+    REQUIRE(version == 4);
+    REQUIRE(out_bids.at(100.0).total == Approx(2.0));
+    REQUIRE(out_bids.at(100.0).by_venue[0] == Approx(0.0));
+    REQUIRE(out_asks.at(101.0).total == Approx(3.0));
+
+    // 6 秒时 3 秒的检查点已覆盖保留窗口，第一段整段淘汰
+    history.commit(6 * s, 5, bids, asks);
+    REQUIRE(history.stats().checkpoints == 1);
+    REQUIRE(history.stats().from_ns == 3 * s);
+    REQUIRE_FALSE(history.book_at(2 * s + s / 2, out_bids, out_asks, version, ts));
+    REQUIRE(history.book_at(3 * s + s / 2, out_bids, out_asks, version, ts));
+    REQUIRE(version == 3);
+    REQUIRE(out_bids.at(100.0).total == Approx(3.0));
+
+    // GetBookAt：未开启时报错，开启后取最新版本
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance"};
+    aggregator::BookAtRequest request;
+    aggregator::BookUpdate response;
+    REQUIRE(test_access::GetBookAt(agg, nullptr, &request, &response).error_code() ==
+            grpc::StatusCode::FAILED_PRECONDITION);
+
+    test_access::history(agg) = std::make_unique<book_history>(history_config{60});
+    test_access::update_consolidated_book(agg, 0, {{book_side::bid, 70000.0, 1.5}, {book_side::ask, 70001.0, 2.0}});
+    ioc.run();
+
+    request.set_with_venues(true);
+    REQUIRE(test_access::GetBookAt(agg, nullptr, &request, &response).ok());
+    REQUIRE(response.version() == 1);
+    REQUIRE(response.bids_size() == 1);
+    REQUIRE(response.bids(0).venue_quantities(0) == Approx(1.5));
+    REQUIRE(response.asks(0).price() == Approx(70001.0));
+
+    request.set_timestamp_ns(1);
+    REQUIRE(test_access::GetBookAt(agg, nullptr, &request, &response).error_code() == grpc::StatusCode::OUT_OF_RANGE);
+}
+
+TEST_CASE("Depth index answers cumulative depth queries", "[depth_index]") {
+    book_memory mem;
+    consolidated_bid_book bids(mem.resource());
+    consolidated_ask_book asks(mem.resource());
+    depth_index index(depth_index_config{0.5, 1024});
+
+    apply_venue_level(bids, 0, 100.0, 1.0);
+    apply_venue_level(asks, 0, 101.0, 2.0);
+    index.rebuild(bids, asks);   // 窗口以 100.5 为中心，覆盖 [-512, +511] 格
+
+    // 增量更新：买方再挂两档，其中 99.0 来自两个交易所
+    auto apply = [&](std::size_t venue, book_side side, double price, double qty) {
+        double delta = side == book_side::bid ? apply_venue_level(bids, venue, price, qty)
+                                              : apply_venue_level(asks, venue, price, qty);
+        index.on_level_changed(side, price, delta);
+    };
+    apply(0, book_side::bid, 99.5, 2.0);
+    apply(0, book_side::bid, 99.0, 3.0);
+    apply(1, book_side::bid, 99.0, 1.0);
+    apply(0, book_side::ask, 102.0, 4.0);
+    apply(0, book_side::bid, 100.0, 0.5);    // 改量
+
+    depth_point p = index.to_price(book_side::bid, 99.5);
+    REQUIRE(p.quantity == Approx(2.5));
+    REQUIRE(p.notional == Approx(0.5 * 100.0 + 2.0 * 99.5));
+    REQUIRE(index.to_price(book_side::bid, 101.0).quantity == Approx(0.0));   // 比最优价还好
+    REQUIRE(index.to_price(book_side::ask, 200.0).quantity == Approx(6.0));
+    REQUIRE_FALSE(index.to_price(book_side::ask, 200.0).past_window);
+
+    p = index.to_quantity(book_side::bid, 3.0);
+    REQUIRE(p.reached);
+    REQUIRE(p.price == Approx(99.0));
+    REQUIRE(p.quantity == Approx(6.5));
+
+    p = index.to_notional(book_side::ask, 300.0);
+    REQUIRE(p.price == Approx(102.0));
+    REQUIRE(p.notional == Approx(2.0 * 101.0 + 4.0 * 102.0));
+
+    p = index.to_quantity(book_side::ask, 7.0);
+    REQUIRE_FALSE(p.reached);
+    REQUIRE(p.quantity == Approx(6.0));
+
+    // 窗口外的档位不计入；中间价离开窗口中部一半后需要重新居中
+    apply(0, book_side::ask, 400.0, 1.0);
+    REQUIRE(index.to_price(book_side::ask, 500.0).past_window);
+    REQUIRE(index.to_price(book_side::ask, 500.0).quantity == Approx(6.0));
+    REQUIRE_FALSE(index.off_center(100.0, 101.0));
+    REQUIRE(index.off_center(100.0, 250.0));
+
+    // 后台重新居中：建树期间的变化在换上新树时补上，换上之前查询仍用旧窗口
+    apply(0, book_side::bid, 249.0, 1.0);
+    apply(0, book_side::ask, 251.0, 1.0);
+    index.begin_rebuild(bids, asks);
+    REQUIRE(index.rebuilding());
+    apply(0, book_side::ask, 252.0, 2.0);
+    REQUIRE(index.to_price(book_side::ask, 500.0).past_window);
+    while (!index.poll_rebuild()) std::this_thread::yield();
+    REQUIRE_FALSE(index.rebuilding());
+    REQUIRE(index.rebuilds() == 2);
+    REQUIRE_FALSE(index.off_center(249.0, 251.0));
+    REQUIRE(index.to_price(book_side::ask, 252.0).quantity == Approx(9.0));
+    REQUIRE_FALSE(index.to_price(book_side::ask, 420.0).past_window);   // 新中间价 (249 + 101) / 2
+    REQUIRE(index.to_price(book_side::ask, 420.0).quantity == Approx(10.0));
+    REQUIRE(index.to_price(book_side::bid, 249.0).quantity == Approx(1.0));
+
+    // QueryDepth 走 strand，整批返回；越过窗口且簿里还有更深档位时标记 truncated
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Binance"};
+    test_access::depth_index(agg) = std::make_unique<depth_index>(depth_index_config{0.5, 1024});
+    test_access::update_consolidated_book(agg, 0, {{book_side::bid, 100.0, 1.0}, {book_side::bid, 99.0, 2.0},
+                                     {book_side::ask, 101.0, 3.0}, {book_side::ask, 900.0, 1.0}});
+    ioc.run();
+    ioc.restart();
+    REQUIRE(test_access::depth_index(agg)->rebuilds() == 1);
+
+    std::thread io([&] {
+        auto guard = boost::asio::make_work_guard(ioc);
+        ioc.run_for(std::chrono::seconds(2));
+    });
+    aggregator::DepthQuery query;
+    auto* q = query.add_items();
+    q->set_side(aggregator::SIDE_BID);
+    q->set_quantity(2.5);
+    q = query.add_items();
+    q->set_side(aggregator::SIDE_ASK);
+    q->set_to_price(1000.0);
+    aggregator::DepthResult result;
+    REQUIRE(test_access::QueryDepth(agg, nullptr, &query, &result).ok());
+    ioc.stop();
+    io.join();
+
+    REQUIRE(result.version() == 1);
+    REQUIRE(result.items_size() == 2);
+    REQUIRE(result.items(0).price() == Approx(99.0));
+    REQUIRE(result.items(0).cumulative_notional() == Approx(100.0 + 198.0));
+    REQUIRE(result.items(1).cumulative_quantity() == Approx(3.0));
+    REQUIRE(result.items(1).truncated());
+}
+
+TEST_CASE("Line arbiter applies first arrival only", "[arbiter]") {
+    line_arbiter arb(2);
+
+    REQUIRE(arb.accept(0, 100, 1'000));
+    REQUIRE_FALSE(arb.accept(1, 100, 4'000));   // B 晚到 3us
+    REQUIRE(arb.accept(1, 101, 5'000));         // B 先到
+    REQUIRE_FALSE(arb.accept(0, 101, 6'000));
+    REQUIRE_FALSE(arb.accept(0, 99, 7'000));    // 比已应用的旧
+
+    REQUIRE(arb.last_seq() == 101);
+    REQUIRE(arb.stats(0).wins == 1);
+    REQUIRE(arb.stats(0).duplicates == 2);
+    REQUIRE(arb.stats(0).lead_ns_total == 3'000);
+    REQUIRE(arb.stats(1).wins == 1);
+    REQUIRE(arb.stats(1).max_lead_ns == 1'000);
+
+    // 交易所重置序列号：连续的旧序列号最终被接受
+    bool accepted = false;
+    for (int i = 0; i < 100 && !accepted; ++i) accepted = arb.accept(0, 1 + i, 10'000 + i);
+    REQUIRE(accepted);
+    REQUIRE(arb.last_seq() < 101);
+
+    // 快照类消息：reset 之后下一个序列号直接成为新基准
+    arb.reset();
+    REQUIRE(arb.accept(1, 1, 20'000));
+    REQUIRE(arb.last_seq() == 1);
+    REQUIRE_FALSE(arb.accept(0, 1, 21'000));
+}
+
+TEST_CASE("Bybit snapshot after a service restart re-bases the A/B lines", "[arbiter]") {
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"Bybit"};
+    bybit_connector bybit(ioc, &agg, "Bybit", "host", "port", "path", nullptr);
+    bybit.set_line_count(2);
+
+    auto book = [](const char* type, int u, const char* bid) {
+        return std::string(R"({"topic":"orderbook.50.BTCUSDT","type":")") + type +
+               R"(","ts":1700000000000,"data":{"s":"BTCUSDT","b":[["70400.0",")" + bid +
+               R"("]],"a":[],"u":)" + std::to_string(u) + R"(,"seq":1},"cts":1700000000000})";
+    };
+    test_access::deliver(bybit, 0, book("snapshot", 5000, "1.0"));
+    test_access::deliver(bybit, 1, book("delta", 5001, "2.0"));
+    test_access::deliver(bybit, 0, book("delta", 5001, "9.0"));   // 另一条线上的同一条增量
+    REQUIRE(bybit.get_bids().at(70400.0) == Approx(2.0));
+
+    // 服务重启：u 从 1 重新开始，快照和之后的增量都要应用
+    test_access::deliver(bybit, 0, book("snapshot", 1, "3.0"));
+    REQUIRE(bybit.get_bids().at(70400.0) == Approx(3.0));
+    test_access::deliver(bybit, 1, book("delta", 2, "4.0"));
+    REQUIRE(bybit.get_bids().at(70400.0) == Approx(4.0));
+    test_access::deliver(bybit, 0, book("delta", 2, "9.0"));
+    REQUIRE(bybit.get_bids().at(70400.0) == Approx(4.0));
+    REQUIRE(bybit.arbiter().last_seq() == 2);
+}
+TEST_CASE("Parallel ingestion across connector strands", "[aggregator][threads]") {
+    // 配合 -DAGGREGATOR_TSAN=ON 跑：多个 io 线程同时解析三家交易所，合并簿 strand 上同时有人取快照
+    boost::asio::io_context ioc;
+    Aggregator agg(ioc);
+    test_access::venue_names(agg) = {"A", "B", "C"};
 
-    auto conn2 = std::make_shared<okx_connector>(ioc, &agg, "OKX", "host", "port", "path", nullptr);
-    conn2->get_bids() = {{70400.0, 1.5}, {70395.0, 0.5}};
-    conn2->get_asks() = {{70410.0, 1.0}, {70420.0, 2.0}};
+    std::vector<std::shared_ptr<binance_connector>> conns;
+    for (std::size_t v = 0; v < 3; ++v) {
+        auto c = std::make_shared<binance_connector>(ioc, &agg, "Binance", "host", "port", "path", nullptr);
+        c->set_venue_id(v);
+        conns.push_back(c);
+    }
 
-    agg.connectors_ = {conn1, conn2};  // 临时 public
+    auto snapshot_msg = [](int i) {
+        double base = 70000.0 + (i % 50);
+        return "{\"lastUpdateId\":" + std::to_string(i + 1) +
+               ",\"bids\":[[\"" + std::to_string(base) + "\",\"1.0\"],[\"" + std::to_string(base - 1) + "\",\"2.0\"]]" +
+               ",\"asks\":[[\"" + std::to_string(base + 1) + "\",\"3.0\"]]}";
+    };
 
-    agg.update_consolidated_book(nullptr);
+    constexpr int MESSAGES = 2000;
+    std::atomic<int> reads{0};
+    for (int i = 0; i < MESSAGES; ++i) {
+        for (auto& c : conns) {
+            boost::asio::post(test_access::strand(*c), [c, msg = snapshot_msg(i)] { test_access::deliver(*c, 0, msg); });
+        }
+        if (i % 20 == 0) {
+            boost::asio::post(test_access::strand(agg), [&agg, &reads] {
+                test_access::build_book_update(agg, true);
+                ++reads;
+            });
+        }
+    }
 
-    REQUIRE(agg.consolidated_bids_[70400.0] == Approx(2.5));
-    REQUIRE(agg.consolidated_bids_[70390.0] == Approx(2.0));
-    REQUIRE(agg.consolidated_bids_[70395.0] == Approx(0.5));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) threads.emplace_back([&ioc] { ioc.run(); });
+    for (auto& t : threads) t.join();
 
-    REQUIRE(agg.consolidated_asks_[70410.0] == Approx(4.0));
-    REQUIRE(agg.consolidated_asks_[70420.0] == Approx(2.0));
+    REQUIRE(reads == MESSAGES / 20);
+    double last = 70000.0 + ((MESSAGES - 1) % 50);
+    REQUIRE(test_access::consolidated_bids(agg).size() == 2);
+    REQUIRE(test_access::consolidated_bids(agg).at(last).total == Approx(3.0));
+    REQUIRE(test_access::consolidated_bids(agg).at(last - 1).total == Approx(6.0));
+    REQUIRE(test_access::consolidated_asks(agg).size() == 1);
+    REQUIRE(test_access::consolidated_asks(agg).at(last + 1).by_venue[2] == Approx(3.0));
 }
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "tick_store.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+
+constexpr char COLUMN_MAGIC[8] = {'A', 'G', 'G', 'C', 'O', 'L', '0', '1'};
+constexpr std::size_t HEADER_BYTES = 64;
+constexpr uint64_t GROW_ROWS = 64 * 1024;   // 每次扩容的行数
+
+struct column_header {
+    char magic[8];
+    uint32_t record_bytes;
+    uint32_t reserved;
+    uint64_t rows;
+};
+static_assert(sizeof(column_header) <= HEADER_BYTES, "column header too large");
+
+constexpr int64_t NS_PER_DAY = 86'400LL * 1'000'000'000LL;
+
+}  // namespace
+
+tick_store_config parse_tick_store_config(const nlohmann::json& j) {
+    tick_store_config cfg;
+    if (!j.is_object()) return cfg;
+
+    cfg.dir = j.value("dir", cfg.dir);
+    cfg.symbol = j.value("symbol", cfg.symbol);
+    cfg.depth = std::max<std::size_t>(1, j.value("depth", cfg.depth));
+    return cfg;
+}
+
+std::string tick_partition_name(int64_t ts_ns) {
+    std::time_t secs = static_cast<std::time_t>(ts_ns / 1'000'000'000LL);
+    std::tm tm{};
+    gmtime_r(&secs, &tm);
+    char buf[16];
+    std::strftime(buf, sizeof(buf), "%Y%m%d", &tm);
+    return buf;
+}
+
+// ===== column_file =====
+
+column_file::~column_file() { close(); }
+
+void column_file::close() {
+    if (base_) {
+        if (writable_) commit();
+        ::munmap(base_, mapped_);
+    }
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    base_ = nullptr;
+    mapped_ = 0;
+    rows_ = 0;
+}
+
+bool column_file::map(std::size_t bytes) {
+    int prot = writable_ ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* p;
+    if (base_) {
+        p = ::mremap(base_, mapped_, bytes, MREMAP_MAYMOVE);
+    } else {
+        p = ::mmap(nullptr, bytes, prot, MAP_SHARED, fd_, 0);
+    }
+    if (p == MAP_FAILED) {
+        std::cerr << "[tick_store] mmap failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    base_ = static_cast<char*>(p);
+    mapped_ = bytes;
+    return true;
+}
+
+bool column_file::open_append(const std::string& path, uint32_t record_bytes) {
+    close();
+    writable_ = true;
+    record_bytes_ = record_bytes;
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        std::cerr << "[tick_store] Cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        std::cerr << "[tick_store] fstat " << path << " failed: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    bool existing = static_cast<std::size_t>(st.st_size) >= HEADER_BYTES;
+    std::size_t size = existing ? static_cast<std::size_t>(st.st_size)
+                                : HEADER_BYTES + GROW_ROWS * record_bytes;
+    if (!existing && ::ftruncate(fd_, static_cast<off_t>(size)) != 0) return false;
+    if (!map(size)) return false;
+
+    auto* h = reinterpret_cast<column_header*>(base_);
+    if (existing) {
+        // 进程重启后接着同一分区写
+        if (std::memcmp(h->magic, COLUMN_MAGIC, sizeof(COLUMN_MAGIC)) != 0 || h->record_bytes != record_bytes) {
+            std::cerr << "[tick_store] Incompatible column file " << path << std::endl;
+            close();
+            return false;
+        }
+        rows_ = h->rows;
+    } else {
+        std::memcpy(h->magic, COLUMN_MAGIC, sizeof(COLUMN_MAGIC));
+        h->record_bytes = record_bytes;
+        h->rows = 0;
+    }
+    return true;
+}
+
+bool column_file::open_read(const std::string& path) {
+    close();
+    writable_ = false;
+
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) return false;
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0 || static_cast<std::size_t>(st.st_size) < HEADER_BYTES) return false;
+    if (!map(static_cast<std::size_t>(st.st_size))) return false;
+
+    const auto* h = reinterpret_cast<const column_header*>(base_);
+    if (std::memcmp(h->magic, COLUMN_MAGIC, sizeof(COLUMN_MAGIC)) != 0) return false;
+    record_bytes_ = h->record_bytes;
+    // 读端只信任已经完整落在映射范围内的行
+    rows_ = std::min<uint64_t>(h->rows, (mapped_ - HEADER_BYTES) / record_bytes_);
+    return true;
+}
+
+bool column_file::reserve() {
+    std::size_t need = HEADER_BYTES + (rows_ + 1) * record_bytes_;
+    if (need <= mapped_) return true;
+    std::size_t size = mapped_ + GROW_ROWS * record_bytes_;
+    if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+        std::cerr << "[tick_store] ftruncate failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return map(size);
+}
+
+bool column_file::append(const void* record) {
+    if (!reserve()) return false;
+    std::memcpy(base_ + HEADER_BYTES + rows_ * record_bytes_, record, record_bytes_);
+    ++rows_;
+    return true;
+}
+
+void column_file::truncate(uint64_t rows) {
+    rows_ = std::min(rows_, rows);
+    commit();
+}
+
+void column_file::commit() {
+    if (base_ && writable_) reinterpret_cast<column_header*>(base_)->rows = rows_;
+}
+
+uint64_t column_file::rows() const { return rows_; }
+
+const void* column_file::record(uint64_t row) const {
+    return base_ + HEADER_BYTES + row * record_bytes_;
+}
+
+// ===== tick_store =====
+
+tick_store::tick_store(tick_store_config cfg) : cfg_(std::move(cfg)) {
+    writer_ = std::thread([this] { run_writer(); });
+}
+
+tick_store::~tick_store() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+}
+
+void tick_store::append(int64_t ts_ns, uint64_t seq,
+                        const consolidated_bid_book& bids, const consolidated_ask_book& asks) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queued_.ts.size() >= MAX_QUEUED_ROWS) {
+            ++dropped_;
+            return;
+        }
+        queued_.ts.push_back(ts_ns);
+        queued_.seq.push_back(seq);
+
+        // 缺档补 0
+        auto copy_side = [this](const auto& book) {
+            const std::size_t px_at = queued_.levels.size();
+            queued_.levels.resize(px_at + 2 * cfg_.depth, 0.0);
+            std::size_t i = 0;
+            for (auto it = book.begin(); it != book.end() && i < cfg_.depth; ++it, ++i) {
+                queued_.levels[px_at + i] = it->first;
+                queued_.levels[px_at + cfg_.depth + i] = it->second.total;
+            }
+        };
+        copy_side(bids);
+        copy_side(asks);
+    }
+    cv_.notify_one();
+}
+
+void tick_store::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return queued_.ts.empty() && !writing_; });
+}
+
+void tick_store::run_writer() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cv_.wait(lock, [this] { return stop_ || !queued_.ts.empty(); });
+        if (queued_.ts.empty()) return;   // 要求退出且已写完
+
+        std::swap(queued_, batch_);
+        const uint64_t dropped = dropped_;
+        dropped_ = 0;
+        writing_ = true;
+        lock.unlock();
+
+        if (dropped > 0) {
+            std::cerr << "[tick_store] Writer fell behind, dropped " << dropped << " rows" << std::endl;
+        }
+        const std::size_t row_levels = 4 * cfg_.depth;
+        for (std::size_t r = 0; r < batch_.ts.size(); ++r) {
+            write_row(batch_.ts[r], batch_.seq[r], batch_.levels.data() + r * row_levels);
+        }
+        batch_.clear();
+
+        lock.lock();
+        writing_ = false;
+        done_cv_.notify_all();
+    }
+}
+
+bool tick_store::roll(int64_t day) {
+    day_ = day;
+    std::string dir = cfg_.dir + "/" + cfg_.symbol + "/" + tick_partition_name(day * NS_PER_DAY);
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        std::cerr << "[tick_store] Cannot create " << dir << ": " << ec.message() << std::endl;
+        return ok_ = false;
+    }
+
+    const uint32_t level_bytes = static_cast<uint32_t>(cfg_.depth * sizeof(double));
+    ok_ = ts_.open_append(dir + "/ts.col", sizeof(int64_t)) &&
+          seq_.open_append(dir + "/seq.col", sizeof(uint64_t)) &&
+          bid_px_.open_append(dir + "/bid_px.col", level_bytes) &&
+          bid_qty_.open_append(dir + "/bid_qty.col", level_bytes) &&
+          ask_px_.open_append(dir + "/ask_px.col", level_bytes) &&
+          ask_qty_.open_append(dir + "/ask_qty.col", level_bytes);
+
+    if (ok_) {
+        // 文件头逐列提交，上次进程在两次提交之间退出时各列行数不同：都退回到最短的一列
+        const uint64_t rows = std::min({ts_.rows(), seq_.rows(), bid_px_.rows(), bid_qty_.rows(),
+                                        ask_px_.rows(), ask_qty_.rows()});
+        for (column_file* col : {&ts_, &seq_, &bid_px_, &bid_qty_, &ask_px_, &ask_qty_}) col->truncate(rows);
+        std::cout << "[tick_store] Appending to " << dir << " (" << ts_.rows() << " rows)" << std::endl;
+    }
+    return ok_;
+}
+
+void tick_store::write_row(int64_t ts_ns, uint64_t seq, const double* levels) {
+    int64_t day = ts_ns / NS_PER_DAY;
+    if (day != day_ && !roll(day)) return;
+    if (!ok_) return;
+
+    // 先确认每一列都放得下，一行要么写进所有列，要么都不写，各列不会错位
+    for (column_file* col : {&ts_, &seq_, &bid_px_, &bid_qty_, &ask_px_, &ask_qty_}) {
+        if (!col->reserve()) return;
+    }
+
+    ts_.append(&ts_ns);
+    seq_.append(&seq);
+    bid_px_.append(levels);
+    bid_qty_.append(levels + cfg_.depth);
+    ask_px_.append(levels + 2 * cfg_.depth);
+    ask_qty_.append(levels + 3 * cfg_.depth);
+
+    // ts 最后提交：读端按 ts 行数判断一行是否完整
+    seq_.commit();
+    bid_px_.commit();
+    bid_qty_.commit();
+    ask_px_.commit();
+    ask_qty_.commit();
+    ts_.commit();
+}
+
+// ===== tick_reader =====
+
+bool tick_reader::open(const std::string& dir, const std::string& symbol, const std::string& yyyymmdd) {
+    std::string base = dir + "/" + symbol + "/" + yyyymmdd;
+    if (!ts_.open_read(base + "/ts.col") ||
+        !seq_.open_read(base + "/seq.col") ||
+        !bid_px_.open_read(base + "/bid_px.col") ||
+        !bid_qty_.open_read(base + "/bid_qty.col") ||
+        !ask_px_.open_read(base + "/ask_px.col") ||
+        !ask_qty_.open_read(base + "/ask_qty.col")) {
+        return false;
+    }
+
+    depth_ = bid_px_.record_bytes() / sizeof(double);
+    rows_ = std::min({ts_.rows(), seq_.rows(), bid_px_.rows(), bid_qty_.rows(), ask_px_.rows(), ask_qty_.rows()});
+    return true;
+}
+
+int64_t tick_reader::ts(uint64_t row) const {
+    return *static_cast<const int64_t*>(ts_.record(row));
+}
+
+uint64_t tick_reader::seq(uint64_t row) const {
+    return *static_cast<const uint64_t*>(seq_.record(row));
+}
+
+const double* tick_reader::bid_px(uint64_t row) const { return static_cast<const double*>(bid_px_.record(row)); }
+const double* tick_reader::bid_qty(uint64_t row) const { return static_cast<const double*>(bid_qty_.record(row)); }
+const double* tick_reader::ask_px(uint64_t row) const { return static_cast<const double*>(ask_px_.record(row)); }
+const double* tick_reader::ask_qty(uint64_t row) const { return static_cast<const double*>(ask_qty_.record(row)); }
+
+uint64_t tick_reader::lower_bound(int64_t ts_ns) const {
+    uint64_t lo = 0, hi = rows_;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (ts(mid) < ts_ns) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}